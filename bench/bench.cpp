@@ -0,0 +1,173 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <benchmark/benchmark.h>
+
+#include "diff.hpp"
+#include "mapped_file.hpp"
+
+// Synthetic inputs are seeded, so every run diffs the same bytes.
+namespace {
+    std::string random_bytes(size_t size, uint64_t seed, unsigned alphabet = 256, unsigned first = 0) {
+        std::mt19937_64 rng(seed);
+        std::string s(size, '\0');
+
+        for (auto& c : s) {
+            c = static_cast<char>(first + rng() % alphabet);
+        }
+
+        return s;
+    }
+
+    // k edits spread over the input, a mix of substitutions, insertions and deletions
+    std::string with_edits(std::string s, size_t k, uint64_t seed) {
+        std::mt19937_64 rng(seed);
+
+        for (size_t i = 0; i < k && !s.empty(); i++) {
+            size_t at = rng() % s.size();
+
+            switch (rng() % 3) {
+                case 0: s[at] = static_cast<char>(rng()); break;
+                case 1: s.insert(at, 1 + rng() % 16, static_cast<char>(rng())); break;
+                default: s.erase(at, std::min<size_t>(1 + rng() % 16, s.size() - at)); break;
+            }
+        }
+
+        return s;
+    }
+
+    // Cuts the input into blocks and swaps random pairs of them
+    std::string with_shifted_blocks(std::string s, size_t block, size_t swaps, uint64_t seed) {
+        std::mt19937_64 rng(seed);
+        size_t blocks = s.size() / block;
+
+        for (size_t i = 0; i < swaps && blocks > 1; i++) {
+            size_t a = rng() % blocks, b = rng() % blocks;
+
+            if (a != b) {
+                std::swap_ranges(s.begin() + static_cast<ptrdiff_t>(a * block), s.begin() + static_cast<ptrdiff_t>((a + 1) * block), s.begin() + static_cast<ptrdiff_t>(b * block));
+            }
+        }
+
+        return s;
+    }
+
+    // Peak resident set of the whole process so far, in bytes
+    double peak_memory() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        return static_cast<double>(usage.ru_maxrss) * 1024;
+    }
+
+    void run(benchmark::State& state, const sequence_view& lhs, const sequence_view& rhs, const DiffOptions& options) {
+        Diff d(options);
+        size_t edits = 0;
+
+        for (auto _ : state) {
+            edits = 0;
+
+            d.diff(lhs, rhs, [&edits](const Patch& p) {
+                edits++;
+                benchmark::DoNotOptimize(p);
+            });
+        }
+
+        auto iterations = static_cast<int64_t>(state.iterations());
+
+        state.SetBytesProcessed(iterations * static_cast<int64_t>(lhs.size() + rhs.size()));
+        state.SetItemsProcessed(iterations * static_cast<int64_t>(edits));
+        state.counters["edits"] = static_cast<double>(edits);
+        state.counters["peak_rss"] = benchmark::Counter(peak_memory(), benchmark::Counter::kDefaults, benchmark::Counter::kIs1024);
+    }
+
+    void run(benchmark::State& state, const std::string& lhs, const std::string& rhs, const DiffOptions& options) {
+        run(state, sequence_view(lhs.c_str(), 0, lhs.size()), sequence_view(rhs.c_str(), 0, rhs.size()), options);
+    }
+
+    DiffOptions threads(int64_t n) {
+        DiffOptions options;
+        options.threads = static_cast<size_t>(n);
+
+        return options;
+    }
+
+    // Text-like bytes with edits at one per KiB, so the snakes are short and D is large
+    void bm_random(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::string lhs = random_bytes(size, 1, 4, 'a');
+        std::string rhs = with_edits(lhs, size / 1024, 2);
+
+        run(state, lhs, rhs, threads(state.range(1)));
+    }
+
+    void bm_near_identical(benchmark::State& state) {
+        std::string lhs = random_bytes(static_cast<size_t>(state.range(0)), 3);
+        std::string rhs = with_edits(lhs, static_cast<size_t>(state.range(1)), 4);
+
+        run(state, lhs, rhs, threads(1));
+    }
+
+    void bm_shifted_blocks(benchmark::State& state) {
+        std::string lhs = random_bytes(static_cast<size_t>(state.range(0)), 5);
+        std::string rhs = with_shifted_blocks(lhs, 1024, 16, 6);
+        DiffOptions options;
+        options.block_size = static_cast<size_t>(state.range(1));
+
+        run(state, lhs, rhs, options);
+    }
+
+    // Disjoint alphabets, nothing matches and the search runs to D = N + M
+    void bm_all_different(benchmark::State& state) {
+        size_t size = static_cast<size_t>(state.range(0));
+        std::string lhs = random_bytes(size, 7, 128, 0);
+        std::string rhs = random_bytes(size, 8, 128, 128);
+        DiffOptions options;
+        options.max_cost = static_cast<size_t>(state.range(1));
+
+        run(state, lhs, rhs, options);
+    }
+}
+
+BENCHMARK(bm_random)->ArgsProduct({ { 1 << 16, 1 << 20 }, { 1, 4 } })->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_near_identical)->ArgsProduct({ { 1 << 20, 1 << 24 }, { 16, 1024 } })->Unit(benchmark::kMillisecond);
+// Without the block stage every swap costs twice a block of edits, so only the small input
+BENCHMARK(bm_shifted_blocks)->Args({ 1 << 14, 0 })->Args({ 1 << 14, 64 })->Args({ 1 << 24, 64 })->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_all_different)->ArgsProduct({ { 1 << 14, 1 << 16 }, { 64 } })->Unit(benchmark::kMillisecond);
+
+// Arguments left over after the benchmark flags are pairs of files, each pair is
+// registered as a corpus benchmark: bin-diff-bench [--benchmark_...] old new ...
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+
+    if (argc % 2 == 0) {
+        std::cerr << "usage: " << argv[0] << " [--benchmark_...] [<old-file> <new-file>]..." << std::endl;
+        return 2;
+    }
+
+    std::vector<std::pair<mapped_file, mapped_file>> corpora;
+    corpora.reserve(static_cast<size_t>(argc) / 2);
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        corpora.emplace_back(mapped_file(argv[i]), mapped_file(argv[i + 1]));
+        const auto& files = corpora.back();
+
+        std::string name = std::string("corpus/") + argv[i + 1];
+
+        benchmark::RegisterBenchmark(name.c_str(), [&files](benchmark::State& state) {
+            run(state, sequence_view(files.first.data(), 0, files.first.size()), sequence_view(files.second.data(), 0, files.second.size()), DiffOptions());
+        })->Unit(benchmark::kMillisecond);
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+#include "rolling_hash.hpp"
+
+// A window that matches between lhs and rhs, offsets relative to the searched ranges
+struct anchor {
+    size_t lhs;
+    size_t rhs;
+    size_t size;
+};
+
+namespace anchor_detail {
+    // lhs side of a candidate, what a scan finds of it is kept by the scan
+    struct candidate {
+        uint64_t hash;
+        size_t lhs;
+        size_t lhs_count;
+    };
+
+    // Open-addressing index of the lhs blocks. It is probed once per rhs position,
+    // so it stays flat and mostly empty.
+    class candidate_table {
+        // The hash is kept next to the index so misses never touch the candidates. The
+        // index is as wide as the hash, the slot is padded to 16 bytes either way.
+        struct slot {
+            uint64_t hash;
+            uint64_t index;
+        };
+
+        std::vector<candidate> m_candidates;
+        std::vector<slot> m_slots;
+        unsigned m_shift;
+
+        size_t slot_of(uint64_t hash) const {
+            return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ull) >> m_shift);
+        }
+
+      public:
+        explicit candidate_table(size_t blocks) : m_candidates(), m_slots(), m_shift(64) {
+            size_t capacity = 1;
+
+            while (capacity < 2 * blocks) {
+                capacity *= 2;
+                m_shift--;
+            }
+
+            m_candidates.reserve(blocks);
+            m_slots.assign(capacity, slot { 0, 0 });
+        }
+
+        void insert(uint64_t hash, size_t lhs) {
+            size_t mask = m_slots.size() - 1;
+
+            for (size_t i = slot_of(hash); ; i = (i + 1) & mask) {
+                if (m_slots[i].index == 0) {
+                    m_candidates.push_back({ hash, lhs, 1 });
+                    m_slots[i] = { hash, m_candidates.size() };
+                    return;
+                } else if (m_slots[i].hash == hash) {
+                    m_candidates[m_slots[i].index - 1].lhs_count++;
+                    return;
+                }
+            }
+        }
+
+        // Position of the candidate in candidates(), or SIZE_MAX
+        size_t find(uint64_t hash) const {
+            size_t mask = m_slots.size() - 1;
+
+            for (size_t i = slot_of(hash); m_slots[i].index != 0; i = (i + 1) & mask) {
+                if (m_slots[i].hash == hash) {
+                    return static_cast<size_t>(m_slots[i].index - 1);
+                }
+            }
+
+            return SIZE_MAX;
+        }
+
+        const std::vector<candidate>& candidates() const {
+            return m_candidates;
+        }
+    };
+
+    // Patience step: longest chain of matches increasing in both lhs and rhs,
+    // dropping chain links whose rhs windows overlap
+    inline std::vector<anchor> longest_increasing_chain(const std::vector<anchor>& matches) {
+        std::vector<size_t> tails;
+        std::vector<size_t> previous(matches.size(), SIZE_MAX);
+
+        for (size_t i = 0; i < matches.size(); i++) {
+            auto it = std::lower_bound(tails.begin(), tails.end(), matches[i].rhs, [&matches](size_t t, size_t rhs) {
+                return matches[t].rhs < rhs;
+            });
+
+            if (it != tails.begin()) {
+                previous[i] = *(it - 1);
+            }
+
+            if (it == tails.end()) {
+                tails.push_back(i);
+            } else {
+                *it = i;
+            }
+        }
+
+        std::vector<anchor> chain;
+
+        for (size_t i = tails.empty() ? SIZE_MAX : tails.back(); i != SIZE_MAX; i = previous[i]) {
+            chain.push_back(matches[i]);
+        }
+
+        std::reverse(chain.begin(), chain.end());
+
+        std::vector<anchor> anchors;
+
+        for (const auto& a : chain) {
+            if (anchors.empty() || anchors.back().rhs + anchors.back().size <= a.rhs) {
+                anchors.push_back(a);
+            }
+        }
+
+        return anchors;
+    }
+}
+
+// The window-aligned blocks of lhs and how often each occurs. Built once per lhs, it
+// can be scanned against any number of rhs inputs, from several threads at once.
+// Elements are bytes or other integers, sizes count elements.
+template <class t_elem>
+class basic_anchor_index {
+    const t_elem* m_lhs;
+    size_t m_lhs_size;
+    size_t m_window;
+    anchor_detail::candidate_table m_table;
+
+  public:
+    basic_anchor_index(const t_elem* lhs, size_t lhs_size, size_t window) :
+        m_lhs(lhs),
+        m_lhs_size(lhs_size),
+        m_window(window),
+        m_table(window > 0 ? lhs_size / window : 0)
+    {
+        for (size_t i = 0; window > 0 && i + window <= lhs_size; i += window) {
+            m_table.insert(rolling_hash::hash(lhs + i, window), i);
+        }
+    }
+
+    basic_anchor_index(const basic_anchor_index&) = default;
+    basic_anchor_index& operator= (const basic_anchor_index&) = default;
+
+    size_t window() const {
+        return m_window;
+    }
+
+    // Anchors between the lhs range [lhs_begin, lhs_end) and rhs, lhs offsets relative
+    // to lhs_begin. Windows are unique among the blocks of all of lhs, so a range
+    // finds at most the anchors a table of its own would.
+    std::vector<anchor> find(const t_elem* rhs, size_t rhs_size, size_t lhs_begin, size_t lhs_end) const {
+        size_t window = m_window;
+
+        if (window == 0 || lhs_end - lhs_begin < window || rhs_size < window) {
+            return { };
+        }
+
+        // Candidates are in lhs order, those of the range are a run of them
+        const auto& candidates = m_table.candidates();
+        auto by_lhs = [](const anchor_detail::candidate& c, size_t at) {
+            return c.lhs < at;
+        };
+
+        size_t first = static_cast<size_t>(std::lower_bound(candidates.begin(), candidates.end(), lhs_begin, by_lhs) - candidates.begin());
+        size_t last = static_cast<size_t>(std::lower_bound(candidates.begin(), candidates.end(), lhs_end - window + 1, by_lhs) - candidates.begin());
+
+        // What the scan found of each candidate of the range: its last rhs position
+        // and how often
+        std::vector<size_t> found_at(last - first, 0);
+        std::vector<size_t> found_count(last - first, 0);
+
+        rolling_hash h(window);
+        h.reset(rhs);
+
+        for (size_t j = 0; j + window <= rhs_size; ) {
+            size_t c = m_table.find(h.value());
+
+            if (c >= first && c < last && candidates[c].lhs_count == 1 && std::equal(m_lhs + candidates[c].lhs, m_lhs + candidates[c].lhs + window, rhs + j)) {
+                found_at[c - first] = j;
+                found_count[c - first]++;
+
+                // Runs of matching blocks are the common case, so the scan jumps past
+                // a match instead of probing every position inside it
+                j += window;
+
+                if (j + window <= rhs_size) {
+                    h.reset(rhs + j);
+                }
+            } else if (j + window < rhs_size) {
+                h.roll(rhs[j], rhs[j + window]);
+                j++;
+            } else {
+                break;
+            }
+        }
+
+        std::vector<anchor> matches;
+
+        for (size_t c = first; c < last; c++) {
+            if (found_count[c - first] == 1) {
+                matches.push_back({ candidates[c].lhs - lhs_begin, found_at[c - first], window });
+            }
+        }
+
+        return anchor_detail::longest_increasing_chain(matches);
+    }
+};
+
+// Finds windows that occur once among the window-aligned blocks of lhs and once
+// among the scanned positions of rhs, and keeps the longest chain of them that is in order on both
+// sides. Splitting on these gives up optimality only where an anchor is wrong.
+// Elements are bytes or other integers, sizes count elements.
+template <class t_elem>
+std::vector<anchor> find_anchors(const t_elem* lhs, size_t lhs_size, const t_elem* rhs, size_t rhs_size, size_t window) {
+    if (window == 0 || lhs_size < window || rhs_size < window) {
+        return { };
+    }
+
+    return basic_anchor_index<t_elem>(lhs, lhs_size, window).find(rhs, rhs_size, 0, lhs_size);
+}
@@ -0,0 +1,651 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// io_uring is driven through its raw system calls, no liburing needed. Building
+// with -DBIN_DIFF_IO_URING=0 leaves only the pread fallback.
+#ifndef BIN_DIFF_IO_URING
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define BIN_DIFF_IO_URING 1
+#else
+#define BIN_DIFF_IO_URING 0
+#endif
+#endif
+
+#if BIN_DIFF_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "thread_pool.hpp"
+
+namespace async_io_detail {
+#ifdef _WIN32
+    inline std::string read_whole(const std::string& path) {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+
+        if (!in) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        std::string data(static_cast<size_t>(in.tellg()), '\0');
+        in.seekg(0);
+
+        if (!in.read(&data[0], static_cast<std::streamsize>(data.size()))) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        return data;
+    }
+
+    inline void write_whole(const std::string& path, const std::string& data) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+        if (!out || !out.write(data.data(), static_cast<std::streamsize>(data.size())) || !out.flush()) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+    }
+#else
+    // Closes the descriptor on every way out
+    class file_descriptor {
+        int m_fd;
+
+      public:
+        explicit file_descriptor(int fd) : m_fd(fd) { }
+
+        file_descriptor(const file_descriptor&) = delete;
+        file_descriptor& operator= (const file_descriptor&) = delete;
+
+        ~file_descriptor() {
+            if (m_fd >= 0) {
+                close(m_fd);
+            }
+        }
+
+        int get() const noexcept {
+            return m_fd;
+        }
+    };
+
+    inline std::string read_whole(const std::string& path) {
+        file_descriptor fd(open(path.c_str(), O_RDONLY));
+        struct stat st;
+
+        if (fd.get() < 0 || fstat(fd.get(), &st) != 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        // A directory may report a size of 0, which would read as an empty file
+        if (S_ISDIR(st.st_mode)) {
+            throw std::system_error(EISDIR, std::generic_category(), path);
+        }
+
+        std::string data(static_cast<size_t>(st.st_size), '\0');
+
+        for (size_t at = 0; at < data.size(); ) {
+            ssize_t n = pread(fd.get(), &data[at], data.size() - at, static_cast<off_t>(at));
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                throw std::system_error(errno, std::generic_category(), path);
+            } else if (n == 0) {
+                throw std::system_error(EIO, std::generic_category(), path + ": file shrank while reading");
+            }
+
+            at += static_cast<size_t>(n);
+        }
+
+        return data;
+    }
+
+    inline void write_whole(const std::string& path, const std::string& data) {
+        file_descriptor fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+
+        if (fd.get() < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        for (size_t at = 0; at < data.size(); ) {
+            ssize_t n = pwrite(fd.get(), data.data() + at, data.size() - at, static_cast<off_t>(at));
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                throw std::system_error(errno, std::generic_category(), path);
+            }
+
+            at += static_cast<size_t>(n);
+        }
+    }
+#endif
+
+#if BIN_DIFF_IO_URING
+    // The submission and completion rings of one io_uring instance, mapped from the
+    // kernel. Only the thread that owns it may push, enter and reap.
+    class uring {
+        int m_fd;
+        void* m_sq_ring;
+        size_t m_sq_ring_size;
+        void* m_cq_ring;
+        size_t m_cq_ring_size;
+        io_uring_sqe* m_sqes;
+        size_t m_sqes_size;
+
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned m_sq_mask;
+        unsigned m_sq_entries;
+        unsigned* m_sq_array;
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        unsigned m_cq_mask;
+        io_uring_cqe* m_cqes;
+
+        // Pushed but not yet handed to the kernel
+        unsigned m_unsubmitted;
+
+        template <class t_field>
+        t_field* at(void* ring, uint32_t offset) {
+            return reinterpret_cast<t_field*>(static_cast<char*>(ring) + offset);
+        }
+
+        void unmap() noexcept {
+            if (m_sqes != nullptr) {
+                munmap(m_sqes, m_sqes_size);
+            }
+
+            if (m_cq_ring != nullptr && m_cq_ring != m_sq_ring) {
+                munmap(m_cq_ring, m_cq_ring_size);
+            }
+
+            if (m_sq_ring != nullptr) {
+                munmap(m_sq_ring, m_sq_ring_size);
+            }
+
+            if (m_fd >= 0) {
+                close(m_fd);
+            }
+
+            m_fd = -1;
+            m_sq_ring = m_cq_ring = nullptr;
+            m_sqes = nullptr;
+        }
+
+      public:
+        // Leaves the ring invalid when the kernel has no io_uring or forbids it
+        explicit uring(unsigned entries) :
+            m_fd(-1),
+            m_sq_ring(nullptr),
+            m_sq_ring_size(0),
+            m_cq_ring(nullptr),
+            m_cq_ring_size(0),
+            m_sqes(nullptr),
+            m_sqes_size(0),
+            m_sq_head(nullptr),
+            m_sq_tail(nullptr),
+            m_sq_mask(0),
+            m_sq_entries(0),
+            m_sq_array(nullptr),
+            m_cq_head(nullptr),
+            m_cq_tail(nullptr),
+            m_cq_mask(0),
+            m_cqes(nullptr),
+            m_unsubmitted(0)
+        {
+            io_uring_params params = { };
+            m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+
+            if (m_fd < 0) {
+                return;
+            }
+
+            m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+            // Newer kernels map both rings with one call
+            if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+                m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+            }
+
+            void* sq = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+            m_sq_ring = sq != MAP_FAILED ? sq : nullptr;
+
+            if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+                m_cq_ring = m_sq_ring;
+            } else if (m_sq_ring != nullptr) {
+                void* cq = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+                m_cq_ring = cq != MAP_FAILED ? cq : nullptr;
+            }
+
+            if (m_cq_ring != nullptr) {
+                m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+                void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+                m_sqes = sqes != MAP_FAILED ? static_cast<io_uring_sqe*>(sqes) : nullptr;
+            }
+
+            if (m_sqes == nullptr) {
+                unmap();
+                return;
+            }
+
+            m_sq_head = at<unsigned>(m_sq_ring, params.sq_off.head);
+            m_sq_tail = at<unsigned>(m_sq_ring, params.sq_off.tail);
+            m_sq_mask = *at<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+            m_sq_entries = params.sq_entries;
+            m_sq_array = at<unsigned>(m_sq_ring, params.sq_off.array);
+            m_cq_head = at<unsigned>(m_cq_ring, params.cq_off.head);
+            m_cq_tail = at<unsigned>(m_cq_ring, params.cq_off.tail);
+            m_cq_mask = *at<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+            m_cqes = at<io_uring_cqe>(m_cq_ring, params.cq_off.cqes);
+        }
+
+        uring(const uring&) = delete;
+        uring& operator= (const uring&) = delete;
+
+        ~uring() {
+            unmap();
+        }
+
+        bool valid() const noexcept {
+            return m_fd >= 0;
+        }
+
+        unsigned entries() const noexcept {
+            return m_sq_entries;
+        }
+
+        // Queues a vectored read or write, false when the submission ring is full
+        bool push(uint8_t opcode, int fd, const iovec* iov, uint64_t offset, uint64_t user_data) {
+            unsigned tail = *m_sq_tail;
+
+            if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) {
+                return false;
+            }
+
+            unsigned index = tail & m_sq_mask;
+            io_uring_sqe& sqe = m_sqes[index];
+
+            sqe = io_uring_sqe { };
+            sqe.opcode = opcode;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uint64_t>(iov);
+            sqe.len = 1;
+            sqe.off = offset;
+            sqe.user_data = user_data;
+
+            m_sq_array[index] = index;
+            __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+            m_unsubmitted++;
+
+            return true;
+        }
+
+        // Hands the queued entries to the kernel and waits for at least wait completions
+        void enter(unsigned wait) {
+            while (m_unsubmitted > 0 || wait > 0) {
+                long n = syscall(__NR_io_uring_enter, m_fd, m_unsubmitted, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+                if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+                    // Busy means completions have to be reaped first, which wait already allows
+                    if (wait == 0) {
+                        return;
+                    }
+
+                    continue;
+                } else if (n < 0) {
+                    throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+                }
+
+                m_unsubmitted -= static_cast<unsigned>(n);
+                return;
+            }
+        }
+
+        // Calls reaped(user_data, result) for every completion there is
+        template <class t_reaped>
+        void reap(t_reaped&& reaped) {
+            unsigned head = *m_cq_head;
+            unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != tail; head++) {
+                const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+                reaped(cqe.user_data, cqe.res);
+            }
+
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+    };
+#endif
+}
+
+// Reads whole files and writes whole buffers in the background, so the CPU-bound
+// work does not wait on the disk. Requests go to an io_uring from one thread that
+// keeps the ring full, split into chunks that the kernel works on at once. Without
+// io_uring, or where it is forbidden, a small pool does pread and pwrite instead.
+// Callbacks run on the I/O threads and must not throw.
+class async_io {
+  public:
+    using read_callback = std::function<void(std::string data, std::exception_ptr error)>;
+    using write_callback = std::function<void(std::exception_ptr error)>;
+
+  private:
+    static constexpr size_t chunk_size = 1 << 20;
+    static constexpr unsigned ring_entries = 64;
+
+    struct request {
+        bool write = false;
+        std::string path = { };
+        std::string data = { };
+        read_callback on_read = nullptr;
+        write_callback on_write = nullptr;
+
+        int fd = -1;
+        int error = 0;
+        size_t chunks = 0;
+        size_t queued = 0;
+        size_t done = 0;
+        size_t in_flight = 0;
+    };
+
+    struct chunk {
+        request* owner;
+        iovec iov;
+        uint64_t offset;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<std::unique_ptr<request>> m_incoming;
+    size_t m_outstanding;
+    bool m_stopping;
+
+#if BIN_DIFF_IO_URING
+    std::unique_ptr<async_io_detail::uring> m_ring;
+#endif
+    std::unique_ptr<thread_pool> m_fallback;
+    std::thread m_thread;
+
+    void finished() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_outstanding--;
+        m_changed.notify_all();
+    }
+
+    static void complete(request& r) {
+        std::exception_ptr error = nullptr;
+
+        if (r.error != 0) {
+            error = std::make_exception_ptr(std::system_error(r.error, std::generic_category(), r.path));
+        }
+
+        if (r.write) {
+            r.on_write(error);
+        } else {
+            r.on_read(error ? std::string() : std::move(r.data), error);
+        }
+    }
+
+    void queue(std::unique_ptr<request> r) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_outstanding++;
+
+            if (m_fallback == nullptr) {
+                m_incoming.push_back(std::move(r));
+                m_changed.notify_all();
+                return;
+            }
+        }
+
+        // The request moves into the task, the pool owns no state of its own
+        m_fallback->submit([this, req = std::shared_ptr<request>(std::move(r))] {
+            try {
+                if (req->write) {
+                    async_io_detail::write_whole(req->path, req->data);
+                    req->on_write(nullptr);
+                } else {
+                    req->on_read(async_io_detail::read_whole(req->path), nullptr);
+                }
+            } catch (...) {
+                if (req->write) {
+                    req->on_write(std::current_exception());
+                } else {
+                    req->on_read(std::string(), std::current_exception());
+                }
+            }
+
+            finished();
+        });
+    }
+
+#if BIN_DIFF_IO_URING
+    // Opens the file and sizes the request, false when there is nothing to submit
+    static bool open_request(request& r) {
+        if (r.write) {
+            r.fd = ::open(r.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        } else {
+            r.fd = ::open(r.path.c_str(), O_RDONLY);
+            struct stat st;
+
+            if (r.fd >= 0 && fstat(r.fd, &st) != 0) {
+                r.error = errno;
+            } else if (r.fd >= 0 && S_ISDIR(st.st_mode)) {
+                r.error = EISDIR;
+            } else if (r.fd >= 0) {
+                r.data.assign(static_cast<size_t>(st.st_size), '\0');
+            }
+        }
+
+        if (r.fd < 0) {
+            r.error = errno;
+        }
+
+        r.chunks = (r.data.size() + chunk_size - 1) / chunk_size;
+
+        return r.error == 0 && r.chunks > 0;
+    }
+
+    bool push(chunk* c) {
+        uint8_t opcode = c->owner->write ? IORING_OP_WRITEV : IORING_OP_READV;
+        return m_ring->push(opcode, c->owner->fd, &c->iov, c->offset, reinterpret_cast<uint64_t>(c));
+    }
+
+    // Short transfers go back into the ring for the rest of their chunk
+    void reaped(chunk* c, int result, std::deque<chunk*>& retry) {
+        request& r = *c->owner;
+        r.in_flight--;
+
+        if (result < 0 && (result == -EINTR || result == -EAGAIN)) {
+            retry.push_back(c);
+            return;
+        } else if (result < 0 || (result == 0 && c->iov.iov_len > 0)) {
+            r.error = r.error != 0 ? r.error : (result < 0 ? -result : EIO);
+        } else if (static_cast<size_t>(result) < c->iov.iov_len) {
+            c->iov.iov_base = static_cast<char*>(c->iov.iov_base) + result;
+            c->iov.iov_len -= static_cast<size_t>(result);
+            c->offset += static_cast<uint64_t>(result);
+            retry.push_back(c);
+            return;
+        }
+
+        r.done++;
+        delete c;
+    }
+
+    void run_ring() {
+        std::list<std::unique_ptr<request>> active;
+        std::deque<chunk*> retry;
+        size_t in_flight = 0;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                if (active.empty() && retry.empty()) {
+                    m_changed.wait(lock, [this] { return !m_incoming.empty() || m_stopping; });
+                }
+
+                if (active.empty() && m_incoming.empty() && m_stopping) {
+                    return;
+                }
+
+                while (!m_incoming.empty()) {
+                    std::unique_ptr<request> r = std::move(m_incoming.front());
+                    m_incoming.pop_front();
+                    lock.unlock();
+                    open_request(*r);
+                    active.push_back(std::move(r));
+                    lock.lock();
+                }
+            }
+
+            // Retried chunks first, then new chunks of the requests in arrival order
+            while (!retry.empty() && push(retry.front())) {
+                retry.front()->owner->in_flight++;
+                retry.pop_front();
+                in_flight++;
+            }
+
+            for (auto& r : active) {
+                while (retry.empty() && r->error == 0 && r->queued < r->chunks) {
+                    size_t offset = r->queued * chunk_size;
+                    size_t size = std::min(chunk_size, r->data.size() - offset);
+                    auto* c = new chunk { r.get(), iovec { &r->data[offset], size }, offset };
+
+                    if (!push(c)) {
+                        delete c;
+                        break;
+                    }
+
+                    r->queued++;
+                    r->in_flight++;
+                    in_flight++;
+                }
+            }
+
+            if (in_flight > 0) {
+                m_ring->enter(1);
+                m_ring->reap([&](uint64_t user_data, int result) {
+                    reaped(reinterpret_cast<chunk*>(user_data), result, retry);
+                    in_flight--;
+                });
+            }
+
+            // A failed request stops queueing, it completes once its chunks are back
+            for (auto it = active.begin(); it != active.end(); ) {
+                request& r = **it;
+                bool drained = r.in_flight == 0 && std::none_of(retry.begin(), retry.end(), [&r](const chunk* c) { return c->owner == &r; });
+
+                if (drained && (r.error != 0 || r.done == r.chunks)) {
+                    if (r.fd >= 0) {
+                        close(r.fd);
+                    }
+
+                    complete(r);
+                    it = active.erase(it);
+                    finished();
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+#endif
+
+  public:
+    // fallback_threads serve the requests when io_uring is not available
+    explicit async_io(size_t fallback_threads = 2) :
+        m_mutex(),
+        m_changed(),
+        m_incoming(),
+        m_outstanding(0),
+        m_stopping(false),
+#if BIN_DIFF_IO_URING
+        m_ring(std::make_unique<async_io_detail::uring>(ring_entries)),
+#endif
+        m_fallback(),
+        m_thread()
+    {
+#if BIN_DIFF_IO_URING
+        if (m_ring->valid()) {
+            m_thread = std::thread(&async_io::run_ring, this);
+            return;
+        }
+
+        m_ring.reset();
+#endif
+        m_fallback = std::make_unique<thread_pool>(fallback_threads);
+    }
+
+    async_io(const async_io&) = delete;
+    async_io& operator= (const async_io&) = delete;
+
+    // Waits for every request to complete
+    ~async_io() {
+        wait();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+
+        m_changed.notify_all();
+
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    bool uses_io_uring() const noexcept {
+        return m_fallback == nullptr;
+    }
+
+    // Reads the whole file at path and hands its bytes to done
+    void read_file(const std::string& path, read_callback done) {
+        auto r = std::make_unique<request>();
+        r->path = path;
+        r->on_read = std::move(done);
+        queue(std::move(r));
+    }
+
+    // Creates or truncates the file at path, writes data to it and calls done
+    void write_file(const std::string& path, std::string data, write_callback done) {
+        auto r = std::make_unique<request>();
+        r->write = true;
+        r->path = path;
+        r->data = std::move(data);
+        r->on_write = std::move(done);
+        queue(std::move(r));
+    }
+
+    // Blocks until every request so far has completed and its callback returned
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this] { return m_outstanding == 0; });
+    }
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+
+#include <type_traits>
+#include <vector>
+
+#include "anchors.hpp"
+#include "block_match.hpp"
+#include "diff_options.hpp"
+
+// What the diffs of many targets against one base share: the block index and the
+// anchor table of the whole base, built once. Each diff still trims its own common
+// prefix and suffix, those depend on the target, and then searches only the part of
+// the index in the range that is left, so the base is hashed once however many
+// targets there are. The index is built for the anchor window and block size of the
+// diffs that use it, and views into the base, which must outlive it. Safe to share
+// between threads.
+template <class t_elem>
+class basic_base_index {
+    static_assert(std::is_integral<t_elem>::value, "only integer elements are hashed");
+
+    const t_elem* m_base;
+    size_t m_size;
+    basic_anchor_index<t_elem> m_anchors;
+    basic_block_index<t_elem> m_blocks;
+
+  public:
+    basic_base_index(const t_elem* base, size_t size, const DiffOptions& options) :
+        m_base(base),
+        m_size(size),
+        m_anchors(base, size, options.anchor_window),
+        m_blocks(base, size, options.block_size)
+    {
+    }
+
+    basic_base_index(const basic_base_index&) = default;
+    basic_base_index& operator= (const basic_base_index&) = default;
+
+    const t_elem* data() const {
+        return m_base;
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    // Whether a diff with options finds its anchors and blocks here
+    bool fits(const DiffOptions& options) const {
+        return options.anchor_window == m_anchors.window() && options.block_size == m_blocks.block_size();
+    }
+
+    // find_anchors() of the base range [lhs, lhs + lhs_size) and rhs
+    std::vector<anchor> anchors(const t_elem* lhs, size_t lhs_size, const t_elem* rhs, size_t rhs_size) const {
+        size_t at = static_cast<size_t>(lhs - m_base);
+
+        return m_anchors.find(rhs, rhs_size, at, at + lhs_size);
+    }
+
+    // Block matches of the base range [lhs, lhs + lhs_size) and rhs
+    std::vector<block_match> matches(const t_elem* lhs, size_t lhs_size, const t_elem* rhs, size_t rhs_size) const {
+        size_t at = static_cast<size_t>(lhs - m_base);
+
+        return m_blocks.matches(rhs, rhs_size, at, at + lhs_size);
+    }
+};
+
+using base_index = basic_base_index<char>;
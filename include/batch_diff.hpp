@@ -0,0 +1,376 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "async_io.hpp"
+#include "diff.hpp"
+#include "patch_cache.hpp"
+#include "patch_format.hpp"
+#include "thread_pool.hpp"
+
+struct BatchJob {
+    std::string lhs;
+    std::string rhs;
+
+    // Where the binary patch goes
+    std::string patch;
+};
+
+struct BatchResult {
+    // Position of the job in the batch, results arrive in the order jobs finish
+    size_t index = 0;
+    bool ok = true;
+    std::string error = { };
+    uint64_t patch_size = 0;
+
+    // The patch came from the cache, the diff did not run
+    bool cached = false;
+
+    // Zero unless built with BIN_DIFF_STATS
+    DiffStats stats = { };
+};
+
+struct BatchOptions {
+    // Pairs whose inputs are read ahead of the diffs running, 0 maps every pair when
+    // its diff starts and writes its patch as it is encoded
+    size_t prefetch = 2;
+
+    // Pairs with a file larger than this are not read ahead but mapped, like above
+    uint64_t prefetch_limit = uint64_t(64) << 20;
+
+    // Threads that read and write when io_uring is not available
+    size_t io_threads = 2;
+
+    // Patches of pairs diffed before are taken from here, new ones are stored
+    PatchCache* cache = nullptr;
+
+    // Applies to every patch, pairs run in parallel already so workers rarely pay off
+    PatchCompression compression = { };
+};
+
+namespace batch_detail {
+    // Inputs of one pair, read ahead of its diff
+    struct prefetched {
+        bool started = false;
+
+        // Too large to read ahead, the diff maps the files itself
+        bool mapped = false;
+
+        // Reads still in flight
+        size_t pending = 0;
+
+        std::string lhs = { };
+        std::string rhs = { };
+        std::exception_ptr error = nullptr;
+    };
+
+    inline std::string message(std::exception_ptr error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+            return e.what();
+        } catch (...) {
+            return "unknown error";
+        }
+    }
+}
+
+// Manifest lines are "old<TAB>new<TAB>patch". Empty lines and lines starting with
+// '#' are skipped.
+inline std::vector<BatchJob> read_manifest(std::istream& in) {
+    std::vector<BatchJob> jobs;
+    std::string line;
+
+    for (size_t number = 1; std::getline(in, line); number++) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t first = line.find('\t');
+        size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+
+        if (second == std::string::npos || line.find('\t', second + 1) != std::string::npos) {
+            throw std::invalid_argument("manifest line " + std::to_string(number) + " is not old<TAB>new<TAB>patch");
+        }
+
+        jobs.push_back({ line.substr(0, first), line.substr(first + 1, second - first - 1), line.substr(second + 1) });
+    }
+
+    return jobs;
+}
+
+// Diffs many file pairs on one pool. Every pair runs on a single thread with the
+// Diff of that thread, so scratch buffers are reused across all the pairs a thread
+// takes instead of being allocated per pair. The inputs of the next pairs are read
+// while the current ones are diffed, and patches are written in the background,
+// both through async_io, so the disk and the cores stay busy at the same time.
+class BatchDiff {
+    DiffOptions m_options;
+    BatchOptions m_batch;
+    std::unique_ptr<thread_pool> m_owned_pool;
+    thread_pool* m_pool;
+
+    // One per pool worker plus one for the calling thread
+    std::vector<std::unique_ptr<Diff>> m_diffs;
+
+    static DiffOptions single_threaded(DiffOptions options) {
+        options.threads = 1;
+        options.pool = nullptr;
+
+        return options;
+    }
+
+    Diff& this_diff() {
+        return *m_diffs[m_pool != nullptr ? m_pool->worker_index() : 0];
+    }
+
+    void encode(const char* lhs, size_t lhs_size, const char* rhs, size_t rhs_size, std::ostream& out, BatchResult& result) {
+        result.cached = encode_patch(this_diff(), DiffKind::Bytes, m_options, sequence_view(lhs, 0, lhs_size), sequence_view(rhs, 0, rhs_size), out, m_batch.cache, m_batch.compression);
+
+        if (!result.cached) {
+            result.stats = this_diff().stats();
+        }
+    }
+
+    BatchResult run_one(size_t index, const BatchJob& job) {
+        BatchResult result;
+        result.index = index;
+
+        try {
+            mapped_file lhs(job.lhs);
+            mapped_file rhs(job.rhs);
+            std::ofstream out(job.patch, std::ios::binary | std::ios::trunc);
+
+            if (!out) {
+                throw std::system_error(errno, std::generic_category(), job.patch);
+            }
+
+            encode(lhs.data(), lhs.size(), rhs.data(), rhs.size(), out, result);
+            result.patch_size = static_cast<uint64_t>(out.tellp());
+        } catch (const std::exception& e) {
+            result.ok = false;
+            result.error = e.what();
+        }
+
+        return result;
+    }
+
+    // Diffs a pair read ahead into memory. The patch is encoded into memory too and
+    // reported once it is written.
+    template <class t_report>
+    void run_prefetched(size_t index, const BatchJob& job, batch_detail::prefetched& in, async_io& io, std::mutex& mutex, t_report& report) {
+        BatchResult result;
+        result.index = index;
+
+        try {
+            if (in.error) {
+                std::rethrow_exception(in.error);
+            }
+
+            std::ostringstream out;
+            encode(in.lhs.data(), in.lhs.size(), in.rhs.data(), in.rhs.size(), out, result);
+            in = batch_detail::prefetched();
+
+            std::string patch = out.str();
+            result.patch_size = patch.size();
+
+            io.write_file(job.patch, std::move(patch), [&mutex, &report, result](std::exception_ptr error) mutable {
+                if (error) {
+                    result.ok = false;
+                    result.error = batch_detail::message(error);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                report(result);
+            });
+
+            return;
+        } catch (const std::exception& e) {
+            result.ok = false;
+            result.error = e.what();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        report(result);
+    }
+
+    // Every lane, the pool workers and the calling thread, takes the next pair in
+    // order, so the pairs read ahead are the ones diffed next. At most lanes plus
+    // prefetch pairs are held in memory.
+    template <class t_report>
+    void run_pipelined(const std::vector<BatchJob>& jobs, t_report& report) {
+        std::vector<batch_detail::prefetched> inputs(jobs.size());
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::atomic<size_t> next(0);
+        size_t lanes = m_pool != nullptr ? m_pool->size() + 1 : 1;
+
+        // Declared after the state its callbacks use, so it drains before that goes
+        async_io io(m_batch.io_threads);
+
+        // Starts the reads of the pairs in [begin, end) not started yet, under mutex
+        auto prefetch = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < std::min(end, jobs.size()); i++) {
+                batch_detail::prefetched& in = inputs[i];
+
+                if (in.started) {
+                    continue;
+                }
+
+                in.started = true;
+
+                // Sizes that cannot be read leave the error to the mapping
+                std::error_code lhs_error, rhs_error;
+                uint64_t lhs_size = std::filesystem::file_size(jobs[i].lhs, lhs_error);
+                uint64_t rhs_size = std::filesystem::file_size(jobs[i].rhs, rhs_error);
+
+                if (lhs_error || rhs_error || lhs_size > m_batch.prefetch_limit || rhs_size > m_batch.prefetch_limit) {
+                    in.mapped = true;
+                    continue;
+                }
+
+                in.pending = 2;
+
+                for (bool left : { true, false }) {
+                    io.read_file(left ? jobs[i].lhs : jobs[i].rhs, [&inputs, &mutex, &ready, i, left](std::string data, std::exception_ptr error) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        batch_detail::prefetched& in = inputs[i];
+
+                        (left ? in.lhs : in.rhs) = std::move(data);
+
+                        if (error && !in.error) {
+                            in.error = error;
+                        }
+
+                        in.pending--;
+                        ready.notify_all();
+                    });
+                }
+            }
+        };
+
+        auto lane = [&] {
+            for (size_t i; (i = next++) < jobs.size(); ) {
+                batch_detail::prefetched in;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    prefetch(i, i + lanes + m_batch.prefetch);
+                    ready.wait(lock, [&inputs, i] { return inputs[i].pending == 0; });
+                    in = std::move(inputs[i]);
+                }
+
+                if (in.mapped) {
+                    BatchResult result = run_one(i, jobs[i]);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    report(result);
+                } else {
+                    run_prefetched(i, jobs[i], in, io, mutex, report);
+                }
+            }
+        };
+
+        if (m_pool == nullptr) {
+            lane();
+        } else {
+            task_group group(*m_pool);
+
+            for (size_t i = 1; i < lanes; i++) {
+                group.run(lane);
+            }
+
+            lane();
+            group.wait();
+        }
+
+        io.wait();
+    }
+
+  public:
+    BatchDiff() : BatchDiff(DiffOptions()) { }
+
+    explicit BatchDiff(const DiffOptions& options, const BatchOptions& batch = BatchOptions()) :
+        m_options(options),
+        m_batch(batch),
+        m_owned_pool(),
+        m_pool(options.pool),
+        m_diffs()
+    {
+        if (m_pool == nullptr && m_options.threads > 1) {
+            m_owned_pool = std::make_unique<thread_pool>(m_options.threads);
+            m_pool = m_owned_pool.get();
+        }
+
+        size_t diffs = m_pool != nullptr ? m_pool->size() + 1 : 1;
+
+        for (size_t i = 0; i < diffs; i++) {
+            m_diffs.push_back(std::make_unique<Diff>(single_threaded(m_options)));
+        }
+    }
+
+    BatchDiff(const BatchDiff&) = delete;
+    BatchDiff& operator= (const BatchDiff&) = delete;
+
+    // Hands a BatchResult per job to report as soon as the job is done and its patch
+    // written. A failed job does not stop the batch, its error is in the result.
+    // report is called from one thread at a time, not necessarily this one.
+    template <class t_report>
+    void run(const std::vector<BatchJob>& jobs, t_report&& report) {
+        if (m_batch.prefetch > 0) {
+            run_pipelined(jobs, report);
+            return;
+        }
+
+        if (m_pool == nullptr) {
+            for (size_t i = 0; i < jobs.size(); i++) {
+                report(run_one(i, jobs[i]));
+            }
+
+            return;
+        }
+
+        std::mutex report_mutex;
+        task_group group(*m_pool);
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            group.run([this, &jobs, &report, &report_mutex, i] {
+                BatchResult result = run_one(i, jobs[i]);
+                std::lock_guard<std::mutex> lock(report_mutex);
+                report(result);
+            });
+        }
+
+        group.wait();
+    }
+
+    std::vector<BatchResult> run(const std::vector<BatchJob>& jobs) {
+        std::vector<BatchResult> results(jobs.size());
+
+        run(jobs, [&results](const BatchResult& r) {
+            results[r.index] = r;
+        });
+
+        return results;
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <string>
+
+#include "diff_options.hpp"
+#include "diff_stats.hpp"
+
+// Interface of the bindiff library. It takes buffers, paths and options and hands
+// back encoded patches, the engine behind it is compiled once into the library, so
+// code that includes this does not instantiate or optimize any of it. The headers
+// of the engine stay usable on their own.
+
+#if defined(_WIN32) && defined(BIN_DIFF_SHARED)
+#ifdef BIN_DIFF_BUILDING
+#define BIN_DIFF_API __declspec(dllexport)
+#else
+#define BIN_DIFF_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define BIN_DIFF_API __attribute__((visibility("default")))
+#else
+#define BIN_DIFF_API
+#endif
+
+struct PatchOptions {
+    // zstd level of the patch records, 0 stores them raw. Needs a library built with zstd.
+    int compression = 0;
+
+    // Directory of a patch cache shared across runs and processes, empty caches nothing
+    std::string cache_directory = { };
+
+    // Bytes of patches the cache directory keeps
+    uint64_t cache_size = uint64_t(1) << 30;
+};
+
+struct DiffResult {
+    // Encoded patch, laid out as described in patch_format.hpp
+    std::string patch = { };
+
+    // The patch came from the cache, the diff did not run
+    bool cached = false;
+
+    // Zero unless the library was built with BIN_DIFF_STATS
+    DiffStats stats = { };
+};
+
+// Diffs pairs of inputs into encoded patches. An engine keeps its scratch buffers and
+// threads between diffs, so reusing one is cheaper than making one per pair. Not safe
+// to use from several threads at once, each thread wants its own.
+class BIN_DIFF_API DiffEngine {
+    struct state;
+    std::unique_ptr<state> m_state;
+
+  public:
+    explicit DiffEngine(const DiffOptions& options = DiffOptions(), const PatchOptions& patch = PatchOptions());
+    ~DiffEngine();
+
+    DiffEngine(DiffEngine&&) noexcept;
+    DiffEngine& operator= (DiffEngine&&) noexcept;
+
+    DiffResult diff(const char* lhs, size_t lhs_size, const char* rhs, size_t rhs_size, DiffKind kind = DiffKind::Bytes);
+
+    // Maps both files instead of reading them
+    DiffResult diff_files(const std::string& lhs, const std::string& rhs, DiffKind kind = DiffKind::Bytes);
+
+    // Rebuilds the target of a patch, the source and the target are checked against
+    // the hashes in the patch
+    static std::string apply(const char* source, size_t source_size, const char* patch, size_t patch_size);
+
+    // Like apply_patch_file, the target may be the source
+    static void apply_files(const std::string& source, const std::string& patch, const std::string& target);
+
+    // Whether patches can be compressed and compressed ones applied
+    static bool compression_available() noexcept;
+};
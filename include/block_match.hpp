@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+#include "anchors.hpp"
+#include "match.hpp"
+#include "rolling_hash.hpp"
+
+// A run of rhs that also occurs in lhs, offsets relative to the indexed and scanned
+// ranges. Unlike anchors, matches need not be in order on lhs, a block that moved
+// is a match too.
+struct block_match {
+    size_t lhs;
+    size_t rhs;
+    size_t size;
+};
+
+// Index of the block-aligned blocks of lhs, in the manner of rsync. Built once per
+// lhs, it can be scanned against any number of rhs inputs. Elements are bytes or
+// other integers, sizes count elements.
+template <class t_elem>
+class basic_block_index {
+    struct slot {
+        uint64_t hash;
+        uint64_t block;
+    };
+
+    const t_elem* m_lhs;
+    size_t m_lhs_size;
+    size_t m_block_size;
+    std::vector<slot> m_slots;
+    unsigned m_shift;
+
+    size_t slot_of(uint64_t hash) const {
+        return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ull) >> m_shift);
+    }
+
+    // Blocks are numbered from 1, 0 marks an empty slot. Of equal blocks the first is kept.
+    void insert(uint64_t hash, uint64_t block) {
+        size_t mask = m_slots.size() - 1;
+
+        for (size_t i = slot_of(hash); ; i = (i + 1) & mask) {
+            if (m_slots[i].block == 0) {
+                m_slots[i] = { hash, block };
+                return;
+            } else if (m_slots[i].hash == hash) {
+                return;
+            }
+        }
+    }
+
+    // lhs offset of the block that hashes to hash and holds the bytes at p, or SIZE_MAX
+    size_t find(uint64_t hash, const t_elem* p) const {
+        size_t mask = m_slots.size() - 1;
+
+        for (size_t i = slot_of(hash); m_slots[i].block != 0; i = (i + 1) & mask) {
+            if (m_slots[i].hash == hash) {
+                size_t at = (m_slots[i].block - 1) * m_block_size;
+                return std::equal(m_lhs + at, m_lhs + at + m_block_size, p) ? at : SIZE_MAX;
+            }
+        }
+
+        return SIZE_MAX;
+    }
+
+  public:
+    basic_block_index(const t_elem* lhs, size_t lhs_size, size_t block_size) :
+        m_lhs(lhs),
+        m_lhs_size(lhs_size),
+        m_block_size(block_size),
+        m_slots(),
+        m_shift(64)
+    {
+        size_t blocks = block_size > 0 ? lhs_size / block_size : 0;
+        size_t capacity = 1;
+
+        while (capacity < 2 * blocks) {
+            capacity *= 2;
+            m_shift--;
+        }
+
+        m_slots.assign(capacity, slot { 0, 0 });
+
+        for (size_t i = 0; i < blocks; i++) {
+            insert(rolling_hash::hash(lhs + i * block_size, block_size), i + 1);
+        }
+    }
+
+    basic_block_index(const basic_block_index&) = default;
+    basic_block_index& operator= (const basic_block_index&) = default;
+
+    size_t block_size() const {
+        return m_block_size;
+    }
+
+    // Rolls over every position of rhs and grows each block hit into the longest
+    // match around it. Matches come out in rhs order and do not overlap on rhs.
+    std::vector<block_match> matches(const t_elem* rhs, size_t rhs_size) const {
+        return matches(rhs, rhs_size, 0, m_lhs_size);
+    }
+
+    // Matches that lie in the lhs range [lhs_begin, lhs_end), lhs offsets relative to
+    // lhs_begin. Blocks reaching out of the range are not hits and matches stop at
+    // its ends, so one index of a whole input serves the diffs of its parts.
+    std::vector<block_match> matches(const t_elem* rhs, size_t rhs_size, size_t lhs_begin, size_t lhs_end) const {
+        std::vector<block_match> found;
+        size_t n = m_block_size;
+
+        if (n == 0 || lhs_end - lhs_begin < n || rhs_size < n) {
+            return found;
+        }
+
+        rolling_hash h(n);
+        h.reset(rhs);
+
+        for (size_t j = 0; j + n <= rhs_size; ) {
+            size_t at = find(h.value(), rhs + j);
+
+            if (at != SIZE_MAX && at >= lhs_begin && at + n <= lhs_end) {
+                size_t floor = found.empty() ? 0 : found.back().rhs + found.back().size;
+                size_t back = match_backward(m_lhs + at, rhs + j, std::min(at - lhs_begin, j - floor));
+                size_t forward = match_forward(m_lhs + at + n, rhs + j + n, std::min(lhs_end - at - n, rhs_size - j - n));
+
+                found.push_back({ at - back - lhs_begin, j - back, back + n + forward });
+                j += n + forward;
+
+                if (j + n <= rhs_size) {
+                    h.reset(rhs + j);
+                }
+            } else if (j + n < rhs_size) {
+                h.roll(rhs[j], rhs[j + n]);
+                j++;
+            } else {
+                break;
+            }
+        }
+
+        return found;
+    }
+};
+
+using block_index = basic_block_index<char>;
+
+// Marks the matches that keep their order on both sides, the rest are moved blocks.
+// This is the patience chain of the anchors with the roles of lhs and rhs swapped,
+// the matches are sorted on rhs and it is lhs that may overlap.
+inline std::vector<bool> in_order_matches(const std::vector<block_match>& matches) {
+    std::vector<anchor> swapped;
+    swapped.reserve(matches.size());
+
+    for (const auto& m : matches) {
+        swapped.push_back({ m.rhs, m.lhs, m.size });
+    }
+
+    std::vector<bool> in_order(matches.size(), false);
+    size_t i = 0;
+
+    for (const auto& a : anchor_detail::longest_increasing_chain(swapped)) {
+        while (matches[i].rhs != a.lhs) {
+            i++;
+        }
+
+        in_order[i] = true;
+    }
+
+    return in_order;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+
+// Flag another thread raises to stop the diffs that watch it. Cancelling is a
+// single atomic store, so it is safe from signal handlers as well.
+class cancel_token {
+    std::atomic<bool> m_cancelled;
+
+  public:
+    cancel_token() : m_cancelled(false) { }
+
+    cancel_token(const cancel_token&) = delete;
+    cancel_token& operator= (const cancel_token&) = delete;
+
+    void cancel() noexcept {
+        m_cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool cancelled() const noexcept {
+        return m_cancelled.load(std::memory_order_relaxed);
+    }
+
+    void reset() noexcept {
+        m_cancelled.store(false, std::memory_order_relaxed);
+    }
+};
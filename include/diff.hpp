@@ -2,35 +2,57 @@
 
 #include <cstdint>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 #include <vector>
 #include <memory>
 #include <list>
 #include <string>
 #include <algorithm>
 #include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "anchors.hpp"
+#include "base_index.hpp"
+#include "block_match.hpp"
+#include "cancel_token.hpp"
+#include "diff_options.hpp"
+#include "diff_stats.hpp"
+#include "diff_trace.hpp"
+#include "mapped_file.hpp"
+#include "match.hpp"
+#include "sweep_team.hpp"
+#include "thread_pool.hpp"
+#include "v_array.hpp"
 
-class sequence_view {
-    const char* m_str;
+template <class t_elem>
+class basic_sequence_view {
+    const t_elem* m_str;
     size_t m_view_index_begin;
     size_t m_view_index_end;
 
 public:
-    sequence_view() : m_str(nullptr), m_view_index_begin(0), m_view_index_end(0) { }
+    basic_sequence_view() : m_str(nullptr), m_view_index_begin(0), m_view_index_end(0) { }
 
-    sequence_view(const char* str, uint32_t begin, uint32_t end) : m_str(str), m_view_index_begin(begin), m_view_index_end(end) { }
+    basic_sequence_view(const t_elem* str, size_t begin, size_t end) : m_str(str), m_view_index_begin(begin), m_view_index_end(end) { }
 
-    sequence_view(const sequence_view& seq, uint32_t begin, uint32_t end) :
+    basic_sequence_view(const basic_sequence_view& seq, size_t begin, size_t end) :
         m_str(seq.m_str),
         m_view_index_begin(seq.m_view_index_begin + begin),
         m_view_index_end(seq.m_view_index_begin + end)
     { }
 
-    sequence_view combine(const sequence_view& other) const {
+    basic_sequence_view combine(const basic_sequence_view& other) const {
         if (m_str != other.m_str) {
-            // Cannot combine sequences with different super sequences
-            throw std::exception();
-        } else if (m_view_index_end >= other.m_view_index_begin || other.m_view_index_end >= m_view_index_begin) {
-            return sequence_view(m_str,
+            throw std::invalid_argument("cannot combine views of different sequences");
+        } else if (m_view_index_end >= other.m_view_index_begin && other.m_view_index_end >= m_view_index_begin) {
+            return basic_sequence_view(m_str,
                 std::min(
                     m_view_index_begin,
                     other.m_view_index_begin
@@ -41,12 +63,11 @@ public:
                 )
             );
         } else {
-            // Cannot combine sequences that do not succeed eachother
-            throw std::exception();
+            throw std::invalid_argument("cannot combine views that neither touch nor overlap");
         }
     }
 
-    char operator[] (size_t i) const {
+    const t_elem& operator[] (size_t i) const {
         return m_str[m_view_index_begin + i];
     }
 
@@ -58,11 +79,11 @@ public:
         return m_view_index_end;
     }
 
-    const char* begin() const noexcept {
+    const t_elem* begin() const noexcept {
         return &m_str[m_view_index_begin];
     }
     
-    const char* end() const noexcept {
+    const t_elem* end() const noexcept {
         return &m_str[m_view_index_end];
     }
 
@@ -71,7 +92,7 @@ public:
     }
 
     template <class t_os>
-    friend t_os& operator<< (t_os& os, const sequence_view& seq) {
+    friend t_os& operator<< (t_os& os, const basic_sequence_view& seq) {
         for (size_t i = seq.m_view_index_begin; i < seq.m_view_index_end; i++) {
             os << seq.m_str[i];
         }
@@ -80,215 +101,981 @@ public:
     }
 };
 
+using sequence_view = basic_sequence_view<char>;
+
+// A Copy adds rhs bytes like an Addition, but they are taken from elsewhere in lhs
 enum class PatchOperation {
     Addition,
     Deletion,
+    Copy,
     Undefined
 };
 
-class Patch {
+// Which input a patch's bytes live in: additions and copies carry rhs bytes, deletions lhs bytes
+enum class PatchSource {
+    Lhs,
+    Rhs
+};
+
+template <class t_os, class t_elem>
+t_os& write_patch_text(t_os& os, PatchOperation op, size_t begin, const t_elem* elements, size_t size, size_t from = 0) {
+    os << "Patch ";
+
+    if (op == PatchOperation::Addition) {
+        os << "Addition";
+    } else if (op == PatchOperation::Deletion) {
+        os << "Deletion";
+    } else if (op == PatchOperation::Copy) {
+        os << "Copy";
+    } else {
+        os << "Undefined";
+    }
+
+    os << ": [" << begin << ':' << begin + size << "] - ";
+
+    if (op == PatchOperation::Copy) {
+        os << "from [" << from << ':' << from + size << "] - ";
+    }
+
+    if constexpr (std::is_same<t_elem, char>::value) {
+        os.write(elements, size);
+    } else {
+        for (size_t i = 0; i < size; i++) {
+            os << (i > 0 ? " " : "") << elements[i];
+        }
+    }
+
+    return os;
+}
+
+// A patch that references the diffed input instead of owning a copy of its bytes.
+// The input must outlive the patch, use OwnedPatch when it does not.
+template <class t_elem>
+class BasicPatch {
+    PatchOperation m_op;
+    basic_sequence_view<t_elem> m_seq;
+    size_t m_from;
+
+    BasicPatch(PatchOperation op, const basic_sequence_view<t_elem>& seq, size_t from = 0) :
+        m_op(op),
+        m_seq(seq),
+        m_from(from)
+    { }
+  public:
+
+    static BasicPatch make_addition(const basic_sequence_view<t_elem>& seq) {
+        return BasicPatch(PatchOperation::Addition, seq);
+    }
+
+    static BasicPatch make_deletion(const basic_sequence_view<t_elem>& seq) {
+        return BasicPatch(PatchOperation::Deletion, seq);
+    }
+
+    // seq is the rhs range, from the lhs offset its bytes are copied from
+    static BasicPatch make_copy(const basic_sequence_view<t_elem>& seq, size_t from) {
+        return BasicPatch(PatchOperation::Copy, seq, from);
+    }
+
+    PatchOperation GetOperation() const {
+        return m_op;
+    }
+
+    PatchSource source() const {
+        return m_op == PatchOperation::Deletion ? PatchSource::Lhs : PatchSource::Rhs;
+    }
+
+    size_t offset() const {
+        return m_seq.index_begin();
+    }
+
+    // lhs offset the bytes of a Copy come from
+    size_t from() const {
+        return m_from;
+    }
+
+    size_t size() const {
+        return m_seq.size();
+    }
+
+    const basic_sequence_view<t_elem>& view() const {
+        return m_seq;
+    }
+
+    const t_elem* data() const {
+        return m_seq.begin();
+    }
+
+    // Byte patches only
+    std::string str() const {
+        return std::string(m_seq.begin(), m_seq.size());
+    }
+
+    template <class t_os>
+    friend t_os& operator<< (t_os& os, const BasicPatch& p) {
+        return write_patch_text(os, p.m_op, p.offset(), p.m_seq.begin(), p.size(), p.m_from);
+    }
+};
+
+using Patch = BasicPatch<char>;
+
+class OwnedPatch {
     PatchOperation m_op;
     size_t m_begin;
     std::string m_str;
+    size_t m_from;
 
-    Patch(PatchOperation op, size_t begin, std::string&& str) :
+  public:
+    OwnedPatch(PatchOperation op, size_t begin, std::string str, size_t from = 0) :
         m_op(op),
         m_begin(begin),
-        m_str(str)
+        m_str(std::move(str)),
+        m_from(from)
     { }
 
-    Patch(PatchOperation op, size_t begin, const std::string& str) :
-        m_op(op),
-        m_begin(begin),
-        m_str(str)
+    explicit OwnedPatch(const Patch& p) :
+        m_op(p.GetOperation()),
+        m_begin(p.offset()),
+        m_str(p.str()),
+        m_from(p.from())
     { }
-  public:
 
-    static Patch make_addition(const sequence_view& seq) {
-        auto str = std::string(std::cbegin(seq), seq.size());
-        return Patch(PatchOperation::Addition, seq.index_begin(), std::move(str));
+    PatchOperation GetOperation() const {
+        return m_op;
     }
 
-    static Patch make_deletion(const sequence_view& seq) {
-        auto str = std::string(std::cbegin(seq), seq.size());
-        return Patch(PatchOperation::Deletion, seq.index_begin(), std::move(str));
+    PatchSource source() const {
+        return m_op == PatchOperation::Deletion ? PatchSource::Lhs : PatchSource::Rhs;
     }
 
-    PatchOperation GetOperation() {
-        return m_op;
+    size_t offset() const {
+        return m_begin;
+    }
+
+    size_t from() const {
+        return m_from;
+    }
+
+    size_t size() const {
+        return m_str.size();
+    }
+
+    const std::string& str() const {
+        return m_str;
+    }
+
+    const char* data() const {
+        return m_str.data();
     }
 
     template <class t_os>
-    friend t_os& operator<< (t_os& os, const Patch& p) {
-        os << "Patch ";
+    friend t_os& operator<< (t_os& os, const OwnedPatch& p) {
+        return write_patch_text(os, p.m_op, p.m_begin, p.m_str.data(), p.m_str.size(), p.m_from);
+    }
+};
 
-        if (p.m_op == PatchOperation::Addition) {
-            os << "Addition";
-        } else if (p.m_op == PatchOperation::Deletion) {
-            os << "Deletion";
-        } else {
-            os << "Undefined";
+inline std::vector<OwnedPatch> to_owned(const std::vector<Patch>& patches) {
+    std::vector<OwnedPatch> owned;
+    owned.reserve(patches.size());
+
+    for (const auto& p : patches) {
+        owned.emplace_back(p);
+    }
+
+    return owned;
+}
+
+// Patches of a file diff view into the mappings, which are kept alive alongside them
+struct FileDiff {
+    mapped_file lhs;
+    mapped_file rhs;
+    std::vector<Patch> patches;
+    DiffStats stats;
+};
+
+template <class t_elem, class t_traits = element_traits<t_elem>>
+class BasicDiff {
+    using view_type = basic_sequence_view<t_elem>;
+    using patch_type = BasicPatch<t_elem>;
+
+    // The halves a middle snake leaves: [0, x) x [0, y) before it and [u, N) x [v, M) after it
+    struct snake {
+        int64_t x;
+        int64_t y;
+        int64_t u;
+        int64_t v;
+    };
+
+    struct sub_problem {
+        view_type lhs;
+        view_type rhs;
+
+        // Splits above this one, for the statistics
+        size_t level;
+    };
+
+    // Per-thread state of the divide and conquer, kept so the capacity is reused
+    struct context {
+        // Scratch for the V arrays of every level. A level's arrays are dead by the
+        // time it splits, so all levels share one buffer sized for the largest. Problems
+        // that fit 32-bit offsets use the narrow one, which halves the cache footprint.
+        std::vector<int32_t> scratch32;
+        std::vector<int64_t> scratch64;
+
+        // Carries the live diagonals over when the V arrays grow
+        std::vector<int32_t> spill32;
+        std::vector<int64_t> spill64;
+
+        // Pending sub-problems
+        std::vector<sub_problem> stack;
+
+        DiffStats stats;
+
+        context() : scratch32(), scratch64(), spill32(), spill64(), stack(), stats() { }
+
+        v_arrays<int32_t> make_v_arrays(int32_t, size_t diagonals) {
+            return { scratch32, spill32, diagonals };
         }
 
-        os << ": [" << p.m_begin << ':' << p.m_begin + p.m_str.size() << "] - " << p.m_str;
+        v_arrays<int64_t> make_v_arrays(int64_t, size_t diagonals) {
+            return { scratch64, spill64, diagonals };
+        }
+    };
 
-        return os;
+    DiffOptions m_options;
+    std::unique_ptr<thread_pool> m_owned_pool;
+    thread_pool* m_pool;
+
+    // One per pool worker plus one for the calling thread. A diff runs one call at a
+    // time, so the last is only ever used by the thread that called it, even when
+    // other threads outside the pool run diffs of their own on the same pool.
+    std::vector<context> m_contexts;
+
+    // Deadline of the running diff, from the options' deadline and timeout
+    std::chrono::steady_clock::time_point m_deadline;
+
+    // Progress of the running diff
+    std::atomic<uint64_t> m_resolved;
+    uint64_t m_total;
+    std::mutex m_progress_mutex;
+
+    // Index of the base of the diff that runs, when it was given one
+    const basic_base_index<t_elem>* m_base;
+
+    context& this_context() {
+        return m_contexts[m_pool != nullptr ? m_pool->worker_index() : 0];
     }
-};
 
-class Diff {
-    std::vector<Patch> _diff(const sequence_view& lhs_seq, const sequence_view& rhs_seq) const {
-        int32_t lhs_size = lhs_seq.size();
-        int32_t rhs_size = rhs_seq.size();
-        int32_t max_len = lhs_size + rhs_size;
-        int32_t x_values_len = 2 * std::min(lhs_size, rhs_size) + 2;
-
-        int32_t x = 0;
-        int32_t y = 0;
-        int32_t z = 0;
-        int32_t x_initial = 0;
-        int32_t y_initial = 0;
-        int32_t u = 0;
-        int32_t v = 0;
-
-        if (lhs_size > 0 && rhs_size > 0) {
-            int32_t w = lhs_size - rhs_size;
-
-            std::vector<int32_t> best_forward_x_values(x_values_len, 0);
-            std::vector<int32_t> best_backward_x_values(x_values_len, 0);
-
-            for (int32_t D = 0; D < (max_len / 2 + (max_len % 2 != 0)) + 1; D++) {
-                // forward snake
-                for (int32_t k = -(D - 2 * std::max(0, D - rhs_size)); k < D - 2 * std::max(0, D - lhs_size) + 1; k += 2) {
-                    if (k == -D || (k != D && best_forward_x_values[(k - 1) % x_values_len] < best_forward_x_values[(k + 1) % x_values_len])) {
-                        x = best_forward_x_values[(k + 1) % x_values_len];
-                    } else {
-                        x = best_forward_x_values[(k - 1) % x_values_len] + 1;
-                    }
-
-                    y = x - k;
-                    x_initial = x;
-                    y_initial = y;
-
-                    while (x < lhs_size && y < rhs_size && lhs_seq[x] == rhs_seq[y]) { // evaluate diagonals
-                        x++;
-                        y++;
-                    }
-
-                    best_forward_x_values[k % x_values_len] = x;
-                    z = -(k - w);
-
-                    if (max_len % 2 == 1 && z >= -(D - 1) && z <= D - 1 && best_forward_x_values[k % x_values_len] + best_backward_x_values[z % x_values_len] >= lhs_size) {
-                        D = 2 * D - 1;
-                        u = x;
-                        v = y;
-                        x = x_initial;
-                        y = y_initial;
-
-                        if (D > 1 || (x != u && y != v)) {
-                            auto temp = std::vector<Patch>(); 
-
-                            std::vector<Patch> forward_subdiff = _diff(
-                                sequence_view(lhs_seq, 0, x),
-                                sequence_view(rhs_seq, 0, y)
-                            );
-
-                            std::vector<Patch> backward_subdiff = _diff(
-                                sequence_view(lhs_seq, u, lhs_size),
-                                sequence_view(rhs_seq, v, rhs_size)
-                            );
-                            
-                            temp.reserve(forward_subdiff.size() + backward_subdiff.size());
-
-                            std::copy(forward_subdiff.begin(), forward_subdiff.end(), std::back_inserter(temp));
-                            std::copy(backward_subdiff.begin(), backward_subdiff.end(), std::back_inserter(temp));
-
-                            return temp;
-                        }
-                        else if (rhs_size > lhs_size) {
-                            return _diff(sequence_view(), sequence_view(rhs_seq, lhs_size, rhs_size));
-                        } else if (rhs_size < lhs_size) {
-                            return _diff(sequence_view(lhs_seq, rhs_size, lhs_size), sequence_view());
-                        } else {
-                            return { };
-                        }
-                    }
+    void checkpoint() const {
+        if (m_options.cancel != nullptr && m_options.cancel->cancelled()) {
+            throw DiffCancelled("diff cancelled");
+        }
+
+        if (m_deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= m_deadline) {
+            throw DiffCancelled("diff deadline exceeded");
+        }
+    }
+
+    // Reports n more elements as resolved, every element of both inputs is reported once
+    void settle(uint64_t n) {
+        if (!m_options.progress || n == 0) {
+            return;
+        }
+
+        uint64_t step = std::max<uint64_t>(m_total / 100, 1);
+        uint64_t resolved = m_resolved.fetch_add(n, std::memory_order_relaxed) + n;
+
+        if (resolved / step != (resolved - n) / step || resolved == m_total) {
+            std::lock_guard<std::mutex> lock(m_progress_mutex);
+            m_options.progress(m_resolved.load(std::memory_order_relaxed), m_total);
+        }
+    }
+
+    template <class t_int>
+    static snake make_snake(t_int D, t_int x, t_int y, t_int u, t_int v, t_int lhs_size, t_int rhs_size) {
+        if (D > 1 || (x != u && y != v)) {
+            return { x, y, u, v };
+        }
+
+        // At most one edit is left and it is the tail of the longer side
+        t_int common = std::min(lhs_size, rhs_size);
+        return { 0, 0, common, common };
+    }
+
+    // Split point at the end of the furthest reaching forward or backward path of round
+    // D. It lies strictly inside the problem, so both halves are smaller than the whole.
+    // Paths on the outermost diagonals may have been pushed past the edges, those are
+    // not points of the edit graph.
+    template <class t_int>
+    static snake _best_split(const v_arrays<t_int>& v, t_int D, t_int lhs_size, t_int rhs_size) {
+        // Without any path to go on, splitting off the first lhs element still makes progress
+        snake s = { 1, 0, 1, 0 };
+        t_int best = 0;
+
+        for (t_int k = -(D - 2 * std::max<t_int>(0, D - rhs_size)); k < D - 2 * std::max<t_int>(0, D - lhs_size) + 1; k += 2) {
+            t_int x = v.forward()[k];
+            t_int y = x - k;
+
+            if (x <= lhs_size && y >= 0 && y <= rhs_size && x + y > best && x + y < lhs_size + rhs_size) {
+                best = x + y;
+                s = { x, y, x, y };
+            }
+
+            x = v.backward()[k];
+            y = x - k;
+
+            if (x <= lhs_size && y >= 0 && y <= rhs_size && x + y > best && x + y < lhs_size + rhs_size) {
+                best = x + y;
+                s = { lhs_size - x, rhs_size - y, lhs_size - x, rhs_size - y };
+            }
+        }
+
+        return s;
+    }
+
+    using search_timer = std::conditional_t<DiffStats::enabled, diff_stats_detail::timer, diff_stats_detail::no_timer>;
+
+    // Diagonals per chunk of a parallel sweep, rounds with fewer than two chunks run
+    // on one thread
+    static constexpr size_t sweep_chunk = 512;
+
+    // The path of a sweep that met a path of the other direction. k_end when none did.
+    template <class t_int>
+    struct sweep_hit {
+        t_int k;
+        t_int x_initial;
+        t_int x;
+    };
+
+    // Extends the paths of round D on the diagonals k_begin, k_begin + 2, ... below
+    // k_end, and stops at the first one that meets a path of the other direction.
+    // Round D only reads the diagonals round D - 1 wrote, which have the other parity,
+    // so disjoint ranges of one round can be swept at the same time.
+    template <bool t_forward, class t_int>
+    static sweep_hit<t_int> _sweep(const view_type& lhs_seq, const view_type& rhs_seq, v_arrays<t_int>& values, t_int D, t_int k_begin, t_int k_end, uint64_t& compared) {
+        t_int lhs_size = static_cast<t_int>(lhs_seq.size());
+        t_int rhs_size = static_cast<t_int>(rhs_seq.size());
+        t_int max_len = lhs_size + rhs_size;
+        t_int w = lhs_size - rhs_size;
+
+        v_array<t_int> best_x_values = t_forward ? values.forward() : values.backward();
+        v_array<t_int> other_x_values = t_forward ? values.backward() : values.forward();
+
+        for (t_int k = k_begin; k < k_end; k += 2) {
+            t_int x;
+
+            if (k == -D || (k != D && best_x_values[k - 1] < best_x_values[k + 1])) {
+                x = best_x_values[k + 1];
+            } else {
+                x = best_x_values[k - 1] + 1;
+            }
+
+            t_int y = x - k;
+            t_int x_initial = x;
+
+            if (x < lhs_size && y < rhs_size) { // evaluate diagonals
+                t_int limit = std::min(lhs_size - x, rhs_size - y);
+                t_int n;
+
+                if constexpr (t_forward) {
+                    n = static_cast<t_int>(t_traits::match_forward(lhs_seq.begin() + x, rhs_seq.begin() + y, limit));
+                } else {
+                    n = static_cast<t_int>(t_traits::match_backward(lhs_seq.begin() + (lhs_size - x), rhs_seq.begin() + (rhs_size - y), limit));
                 }
 
-                // backward snake
-                for (int32_t k = -(D - 2 * std::max(0, D - rhs_size)); k < D - 2 * std::max(0, D - lhs_size) + 1; k += 2) {
-                    if (k == -D || (k != D && best_backward_x_values[(k - 1) % x_values_len] < best_backward_x_values[(k + 1) % x_values_len])) {
-                        x = best_backward_x_values[(k + 1) % x_values_len];
-                    } else {
-                        x = best_backward_x_values[(k - 1) % x_values_len] + 1;
-                    }
-
-                    y = x - k;
-                    x_initial = x;
-                    y_initial = y;
-
-                    while (x < lhs_size && y < rhs_size && lhs_seq[lhs_size - x - 1] == rhs_seq[rhs_size - y - 1]) { // evaluate diagonals
-                        x++;
-                        y++;
-                    }
-
-                    best_backward_x_values[k % x_values_len] = x;
-                    z = -(k - w);
-
-                    if (max_len % 2 == 0 && z >= -D && z <= D && best_backward_x_values[k % x_values_len] + best_forward_x_values[z % x_values_len] >= lhs_size) {
-                        D = 2 * D;
-                        u = lhs_size - x_initial;
-                        v = rhs_size - y_initial;
-                        x = lhs_size - x;
-                        y = rhs_size - y;
-
-                        if (D > 1 || (x != u && y != v)) {
-                            auto temp = std::vector<Patch>();
-
-                            std::vector<Patch> forward_subdiff = _diff(
-                                sequence_view(lhs_seq, 0, x),
-                                sequence_view(rhs_seq, 0, y)
-                            );
-
-                            std::vector<Patch> backward_subdiff = _diff(
-                                sequence_view(lhs_seq, u, lhs_size),
-                                sequence_view(rhs_seq, v, rhs_size)
-                            );
-
-                            temp.reserve(forward_subdiff.size() + backward_subdiff.size());
-
-                            std::copy(forward_subdiff.begin(), forward_subdiff.end(), std::back_inserter(temp));
-                            std::copy(backward_subdiff.begin(), backward_subdiff.end(), std::back_inserter(temp));
-
-                            return temp;
-                        } else if (rhs_size > lhs_size) {
-                            return _diff(sequence_view(), sequence_view(rhs_seq, lhs_size, rhs_size));
-                        } else if (rhs_size < lhs_size) {
-                            return _diff(sequence_view(lhs_seq, rhs_size, lhs_size), sequence_view());
-                        } else {
-                            return { };
-                        }
-                    }
+                x += n;
+
+                if constexpr (DiffStats::enabled) {
+                    compared += static_cast<uint64_t>(n + (n < limit));
                 }
             }
-        }  else if (lhs_size > 0) {
-            return { Patch::make_deletion(lhs_seq) };
+
+            best_x_values[k] = x;
+            t_int z = -(k - w);
+
+            // Forward paths meet the backward paths of round D - 1, backward ones the forward paths of round D
+            if (t_forward ? max_len % 2 == 1 && z >= -(D - 1) && z <= D - 1 : max_len % 2 == 0 && z >= -D && z <= D) {
+                if (x + other_x_values[z] >= lhs_size) {
+                    return { k, x_initial, x };
+                }
+            }
+        }
+
+        return { k_end, 0, 0 };
+    }
+
+    // Sweeps one direction of round D, split across the team when the round is wide
+    // enough. The chunks stop at their own first hit, and the lowest diagonal that
+    // met wins, the same one a sweep on one thread stops at.
+    template <bool t_forward, class t_int>
+    sweep_hit<t_int> _sweep_round(std::unique_ptr<sweep_team>& team, size_t helpers, std::vector<sweep_hit<t_int>>& hits, std::vector<uint64_t>& counts,
+        const view_type& lhs_seq, const view_type& rhs_seq, v_arrays<t_int>& values, t_int D, uint64_t& compared)
+    {
+        t_int k_begin = -(D - 2 * std::max<t_int>(0, D - static_cast<t_int>(rhs_seq.size())));
+        t_int k_end = D - 2 * std::max<t_int>(0, D - static_cast<t_int>(lhs_seq.size())) + 1;
+        size_t diagonals = static_cast<size_t>(k_end - k_begin + 1) / 2;
+
+        if (helpers == 0 || diagonals < 2 * sweep_chunk) {
+            return _sweep<t_forward>(lhs_seq, rhs_seq, values, D, k_begin, k_end, compared);
+        }
+
+        if (!team) {
+            team = std::make_unique<sweep_team>(*m_pool, helpers);
+        }
+
+        size_t chunks = (diagonals + sweep_chunk - 1) / sweep_chunk;
+        hits.resize(chunks);
+        counts.assign(chunks, 0);
+
+        auto work = [&](size_t i) {
+            t_int begin = k_begin + static_cast<t_int>(2 * sweep_chunk * i);
+            t_int end = std::min<t_int>(k_end, begin + static_cast<t_int>(2 * sweep_chunk));
+            hits[i] = _sweep<t_forward>(lhs_seq, rhs_seq, values, D, begin, end, counts[i]);
+        };
+
+        team->run(chunks, work);
+
+        for (uint64_t n : counts) {
+            compared += n;
+        }
+
+        for (size_t i = 0; i < chunks; i++) {
+            if (hits[i].k < std::min<t_int>(k_end, k_begin + static_cast<t_int>(2 * sweep_chunk * (i + 1)))) {
+                return hits[i];
+            }
+        }
+
+        return { k_end, 0, 0 };
+    }
+
+    // Pool workers that may join the sweeps of a search. Helpers spin between rounds,
+    // so there are never more of them than spare cores, and only workers that are
+    // idle when the search starts are taken. Under nested parallelism the workers
+    // busy with other sub-diffs are left to them instead of spinning for this one.
+    size_t sweep_helpers(const view_type& lhs_seq, const view_type& rhs_seq) const {
+        if (m_pool == nullptr || m_options.parallel_sweep == 0 || lhs_seq.size() + rhs_seq.size() < m_options.parallel_sweep) {
+            return 0;
+        }
+
+        if (BIN_DIFF_SWEEP_HELPERS > 0) {
+            return std::min<size_t>(m_pool->size(), BIN_DIFF_SWEEP_HELPERS);
+        }
+
+        size_t cores = std::thread::hardware_concurrency();
+        size_t spare = cores == 0 ? m_pool->size() : std::min(m_pool->size(), cores - 1);
+
+        return std::min(spare, m_pool->idle());
+    }
+
+    template <class t_int>
+    snake _middle_snake(context& ctx, const view_type& lhs_seq, const view_type& rhs_seq, size_t level) {
+        t_int lhs_size = static_cast<t_int>(lhs_seq.size());
+        t_int rhs_size = static_cast<t_int>(rhs_seq.size());
+        t_int max_len = lhs_size + rhs_size;
+
+        t_int x = 0;
+        t_int y = 0;
+        t_int u = 0;
+        t_int v = 0;
+
+        size_t max_cost = m_options.max_cost > 0 ? m_options.max_cost : std::numeric_limits<size_t>::max();
+
+        // Every live diagonal and its neighbours fit in 2 * min(N, M) + 2 slots. A
+        // bounded search stays within max_cost + 1 of diagonal 0, so it needs fewer.
+        size_t diagonals = 2 * std::min(lhs_seq.size(), rhs_seq.size()) + 2;
+
+        if (max_cost < diagonals / 2) {
+            diagonals = 2 * max_cost + 4;
+        }
+
+        v_arrays<t_int> values = ctx.make_v_arrays(t_int(), diagonals);
+
+        if constexpr (DiffStats::enabled) {
+            ctx.stats.searches++;
+        }
+
+        search_timer timer;
+
+        // Only searches over large problems take helpers, they join once a round is wide
+        size_t helpers = sweep_helpers(lhs_seq, rhs_seq);
+        std::unique_ptr<sweep_team> team;
+        std::vector<sweep_hit<t_int>> hits;
+        std::vector<uint64_t> counts;
+        uint64_t compared = 0;
+
+        for (t_int D = 0; D < (max_len / 2 + (max_len % 2 != 0)) + 1; D++) {
+            if (D % 64 == 0) {
+                checkpoint();
+            }
+
+            values.prepare(D);
+
+            // forward snake
+            t_int k_end = D - 2 * std::max<t_int>(0, D - lhs_size) + 1;
+            sweep_hit<t_int> hit = _sweep_round<true>(team, helpers, hits, counts, lhs_seq, rhs_seq, values, D, compared);
+
+            if (hit.k != k_end) {
+                D = 2 * D - 1;
+                u = hit.x;
+                v = hit.x - hit.k;
+                x = hit.x_initial;
+                y = hit.x_initial - hit.k;
+
+                timer.stop(ctx.stats.forward_ns);
+                count_compared(ctx, compared);
+                record(ctx, level, D, values);
+
+                return make_snake(D, x, y, u, v, lhs_size, rhs_size);
+            }
+
+            timer.stop(ctx.stats.forward_ns);
+
+            // backward snake
+            hit = _sweep_round<false>(team, helpers, hits, counts, lhs_seq, rhs_seq, values, D, compared);
+
+            if (hit.k != k_end) {
+                D = 2 * D;
+                u = lhs_size - hit.x_initial;
+                v = rhs_size - (hit.x_initial - hit.k);
+                x = lhs_size - hit.x;
+                y = rhs_size - (hit.x - hit.k);
+
+                timer.stop(ctx.stats.backward_ns);
+                count_compared(ctx, compared);
+                record(ctx, level, D, values);
+
+                return make_snake(D, x, y, u, v, lhs_size, rhs_size);
+            }
+
+            timer.stop(ctx.stats.backward_ns);
+
+            if (static_cast<size_t>(D) >= max_cost) {
+                count_compared(ctx, compared);
+                record(ctx, level, D, values);
+                return _best_split(values, D, lhs_size, rhs_size);
+            }
+        }
+
+        // Both sides are non-empty, so the search always ends on a snake
+        throw std::logic_error("middle snake not found");
+    }
+
+    // Problems whose offsets, sums and D all fit in 32 bits take the narrow search,
+    // larger ones the 64-bit one
+    snake _middle_snake(context& ctx, const view_type& lhs_seq, const view_type& rhs_seq, size_t level) {
+        trace_detail::scope trace(m_options.trace, "snake", level, lhs_seq.size() + rhs_seq.size());
+
+        if (lhs_seq.size() + rhs_seq.size() <= static_cast<size_t>(std::numeric_limits<int32_t>::max()) - 2) {
+            return _middle_snake<int32_t>(ctx, lhs_seq, rhs_seq, level);
+        }
+
+        return _middle_snake<int64_t>(ctx, lhs_seq, rhs_seq, level);
+    }
+
+    static void count_compared(context& ctx, uint64_t compared) {
+        if constexpr (DiffStats::enabled) {
+            ctx.stats.compared += compared;
+        }
+    }
+
+    template <class t_int>
+    static void record(context& ctx, size_t level, t_int D, const v_arrays<t_int>& values) {
+        if constexpr (DiffStats::enabled) {
+            ctx.stats.reached(level, static_cast<uint64_t>(D));
+            ctx.stats.scratch_bytes += values.grown();
+        }
+    }
+
+    static sub_problem before_snake(const sub_problem& p, const snake& s) {
+        return { view_type(p.lhs, 0, s.x), view_type(p.rhs, 0, s.y), p.level + 1 };
+    }
+
+    static sub_problem after_snake(const sub_problem& p, const snake& s) {
+        return { view_type(p.lhs, s.u, p.lhs.size()), view_type(p.rhs, s.v, p.rhs.size()), p.level + 1 };
+    }
+
+    template <class t_sink>
+    void _diff(context& ctx, const sub_problem& problem, t_sink& sink) {
+        ctx.stack.clear();
+        ctx.stack.push_back(problem);
+
+        while (!ctx.stack.empty()) {
+            sub_problem p = ctx.stack.back();
+            ctx.stack.pop_back();
+
+            if (p.lhs.size() > 0 && p.rhs.size() > 0) {
+                snake s = _middle_snake(ctx, p.lhs, p.rhs, p.level);
+                settle(static_cast<uint64_t>((s.u - s.x) + (s.v - s.y)));
+
+                // Pushed in reverse so the half before the snake is resolved, and emitted, first
+                ctx.stack.push_back(after_snake(p, s));
+                ctx.stack.push_back(before_snake(p, s));
+            } else if (p.lhs.size() > 0) {
+                sink(patch_type::make_deletion(p.lhs));
+                settle(p.lhs.size());
+            } else if (p.rhs.size() > 0) {
+                sink(patch_type::make_addition(p.rhs));
+                settle(p.rhs.size());
+            }
+        }
+    }
+
+    // Sink of a forked half. One type for every level keeps the instantiations finite.
+    struct patch_buffer {
+        std::vector<patch_type>& out;
+
+        void operator() (const patch_type& p) {
+            out.push_back(p);
+        }
+    };
+
+    bool below_cutoff(const sub_problem& p) const {
+        return p.lhs.size() == 0 || p.rhs.size() == 0 || p.lhs.size() + p.rhs.size() < m_options.parallel_cutoff;
+    }
+
+    // Forks only when both halves of a split are worth a task. A small half before
+    // the snake is resolved right away, a small half after it is deferred until
+    // everything before it has been emitted, so patches stay in order. The calling
+    // thread emits straight into the sink, forked halves are buffered until joined.
+    template <class t_sink>
+    void _diff_parallel(sub_problem p, t_sink& sink) {
+        std::vector<sub_problem> deferred;
+
+        while (true) {
+            if (below_cutoff(p)) {
+                _diff(this_context(), p, sink);
+                break;
+            }
+
+            snake s = _middle_snake(this_context(), p.lhs, p.rhs, p.level);
+            settle(static_cast<uint64_t>((s.u - s.x) + (s.v - s.y)));
+            sub_problem before = before_snake(p, s);
+            sub_problem after = after_snake(p, s);
+
+            if (!below_cutoff(before) && !below_cutoff(after)) {
+                std::vector<patch_type> after_out;
+                task_group group(*m_pool);
+
+                group.run([this, after, &after_out] {
+                    patch_buffer buffer { after_out };
+                    _diff_parallel(after, buffer);
+                });
+
+                _diff_parallel(before, sink);
+                group.wait();
+
+                for (const auto& patch : after_out) {
+                    sink(patch);
+                }
+
+                break;
+            } else if (below_cutoff(before)) {
+                _diff(this_context(), before, sink);
+                p = after;
+            } else {
+                deferred.push_back(after);
+                p = before;
+            }
+        }
+
+        for (auto it = deferred.rbegin(); it != deferred.rend(); ++it) {
+            _diff(this_context(), *it, sink);
+        }
+    }
+
+    template <class t_sink>
+    void _run(const view_type& lhs, const view_type& rhs, t_sink& sink) {
+        checkpoint();
+        trace_detail::scope trace(m_options.trace, "myers", 0, lhs.size() + rhs.size());
+
+        if (m_pool != nullptr) {
+            _diff_parallel({ lhs, rhs, 0 }, sink);
         } else {
-            return { Patch::make_addition(rhs_seq) };
+            _diff(m_contexts[0], { lhs, rhs, 0 }, sink);
+        }
+    }
+
+    // Anchors and blocks are hashed, so only integer elements have them
+    static constexpr bool hashable = std::is_integral<t_elem>::value;
+
+    template <class t_sink>
+    void _diff_anchored(const view_type& lhs, const view_type& rhs, t_sink& sink) {
+        size_t lhs_at = 0;
+        size_t rhs_at = 0;
+
+        if constexpr (hashable) {
+            std::vector<anchor> anchors;
+
+            {
+                trace_detail::scope trace(m_options.trace, "index", 0, lhs.size() + rhs.size());
+                anchors = m_base != nullptr ? m_base->anchors(lhs.begin(), lhs.size(), rhs.begin(), rhs.size()) :
+                    find_anchors(lhs.begin(), lhs.size(), rhs.begin(), rhs.size(), m_options.anchor_window);
+            }
+
+            for (const auto& a : anchors) {
+                _run(view_type(lhs, lhs_at, a.lhs), view_type(rhs, rhs_at, a.rhs), sink);
+                settle(2 * a.size);
+                lhs_at = a.lhs + a.size;
+                rhs_at = a.rhs + a.size;
+            }
         }
 
-        return { };
+        _run(view_type(lhs, lhs_at, lhs.size()), view_type(rhs, rhs_at, rhs.size()), sink);
+    }
+
+    // A gap between in-order matches, with the moved blocks of rhs that fall in it.
+    // The moved blocks become copies and split the rhs gap into pieces. The lhs gap
+    // is diffed against the longest piece, the other pieces are additions.
+    template <class t_sink>
+    void _diff_gap(const view_type& lhs, const view_type& rhs, size_t lhs_at, size_t lhs_end, size_t rhs_at, size_t rhs_end,
+        const std::vector<block_match>& moved, t_sink& sink)
+    {
+        // Piece i runs from the end of moved block i - 1 to the start of moved block i
+        auto piece_begin = [&](size_t i) { return i > 0 ? moved[i - 1].rhs + moved[i - 1].size : rhs_at; };
+        auto piece_end = [&](size_t i) { return i < moved.size() ? moved[i].rhs : rhs_end; };
+
+        size_t longest = 0;
+
+        for (size_t i = 1; i <= moved.size(); i++) {
+            if (piece_end(i) - piece_begin(i) > piece_end(longest) - piece_begin(longest)) {
+                longest = i;
+            }
+        }
+
+        for (size_t i = 0; i <= moved.size(); i++) {
+            view_type piece(rhs, piece_begin(i), piece_end(i));
+
+            if (i == longest) {
+                _diff_anchored(view_type(lhs, lhs_at, lhs_end), piece, sink);
+            } else if (piece.size() > 0) {
+                sink(patch_type::make_addition(piece));
+                settle(piece.size());
+            }
+
+            if (i < moved.size()) {
+                sink(patch_type::make_copy(view_type(rhs, moved[i].rhs, moved[i].rhs + moved[i].size), lhs.index_begin() + moved[i].lhs));
+                settle(moved[i].size);
+            }
+        }
+    }
+
+    template <class t_sink>
+    void _diff_blocks(const view_type& lhs, const view_type& rhs, t_sink& sink) {
+        std::vector<block_match> matches;
+
+        {
+            trace_detail::scope trace(m_options.trace, "index", 0, lhs.size() + rhs.size());
+            matches = m_base != nullptr ? m_base->matches(lhs.begin(), lhs.size(), rhs.begin(), rhs.size()) :
+                basic_block_index<t_elem>(lhs.begin(), lhs.size(), m_options.block_size).matches(rhs.begin(), rhs.size());
+        }
+
+        auto in_order = in_order_matches(matches);
+
+        // Matches in order leave the search a gap on both sides, moved ones only on rhs
+        std::vector<block_match> moved;
+        size_t lhs_at = 0;
+        size_t rhs_at = 0;
+
+        for (size_t i = 0; i <= matches.size(); i++) {
+            if (i < matches.size() && !in_order[i]) {
+                moved.push_back(matches[i]);
+                continue;
+            }
+
+            size_t lhs_end = i < matches.size() ? matches[i].lhs : lhs.size();
+            size_t rhs_end = i < matches.size() ? matches[i].rhs : rhs.size();
+
+            _diff_gap(lhs, rhs, lhs_at, lhs_end, rhs_at, rhs_end, moved, sink);
+            moved.clear();
+
+            if (i < matches.size()) {
+                settle(2 * matches[i].size);
+                lhs_at = matches[i].lhs + matches[i].size;
+                rhs_at = matches[i].rhs + matches[i].size;
+            }
+        }
     }
 
   public:
-    Diff() { }
+    BasicDiff() : BasicDiff(DiffOptions()) { }
+
+    explicit BasicDiff(const DiffOptions& options) :
+        m_options(options),
+        m_owned_pool(),
+        m_pool(options.pool),
+        m_contexts(),
+        m_deadline(options.deadline),
+        m_resolved(0),
+        m_total(0),
+        m_progress_mutex(),
+        m_base(nullptr)
+    {
+        if (m_pool == nullptr && m_options.threads > 1) {
+            m_owned_pool = std::make_unique<thread_pool>(m_options.threads);
+            m_pool = m_owned_pool.get();
+        }
+
+        m_contexts.resize(m_pool != nullptr ? m_pool->size() + 1 : 1);
+    }
+
+    BasicDiff(const BasicDiff&) = delete;
+    BasicDiff& operator= (const BasicDiff&) = delete;
 
     template <class t_type>
     static const std::string_view make_string_view(const t_type& s, size_t begin, size_t end) {
         return std::string_view(&s[begin], end - begin);
     }
 
-    auto diff(const std::string& lhs, const std::string& rhs) {
-        return _diff(sequence_view(lhs.c_str(), 0, lhs.size()), sequence_view(rhs.c_str(), 0, rhs.size()));
+    // Hands every patch to sink as soon as it is known, in order. The patches view
+    // into lhs and rhs, a sink that keeps them must keep the inputs alive too.
+    template <class t_sink>
+    void diff(const view_type& lhs, const view_type& rhs, t_sink&& sink) {
+        m_deadline = m_options.deadline;
+
+        if (m_options.timeout > std::chrono::steady_clock::duration::zero()) {
+            auto now = std::chrono::steady_clock::now();
+
+            // A timeout past the deadline, or past the end of the clock, leaves it as it is
+            if (m_options.timeout < m_deadline - now) {
+                m_deadline = now + m_options.timeout;
+            }
+        }
+
+        if constexpr (DiffStats::enabled) {
+            for (auto& ctx : m_contexts) {
+                ctx.stats = DiffStats();
+            }
+        }
+
+        // The common prefix and suffix are part of every shortest edit script
+        size_t common = std::min(lhs.size(), rhs.size());
+        size_t prefix = 0;
+        size_t suffix = 0;
+
+        {
+            trace_detail::scope trace(m_options.trace, "trim", 0, lhs.size() + rhs.size());
+            prefix = common > 0 ? t_traits::match_forward(lhs.begin(), rhs.begin(), common) : 0;
+            suffix = common > prefix ? t_traits::match_backward(lhs.end(), rhs.end(), common - prefix) : 0;
+        }
+
+        view_type lhs_middle(lhs, prefix, lhs.size() - suffix);
+        view_type rhs_middle(rhs, prefix, rhs.size() - suffix);
+
+        m_resolved.store(0, std::memory_order_relaxed);
+        m_total = lhs.size() + rhs.size();
+        settle(2 * (prefix + suffix));
+
+        if constexpr (hashable) {
+            if (m_options.block_size > 0) {
+                _diff_blocks(lhs_middle, rhs_middle, sink);
+                return;
+            }
+        }
+
+        _diff_anchored(lhs_middle, rhs_middle, sink);
     }
-};
\ No newline at end of file
+
+    // Diffs the base of index to rhs, taking anchors and blocks from the index instead
+    // of hashing the base again. The index must fit the options of this diff. Only
+    // the index is shared, so diffs of one base may run on many threads at once.
+    template <class t_sink>
+    void diff(const basic_base_index<t_elem>& base, const view_type& rhs, t_sink&& sink) {
+        if (!base.fits(m_options)) {
+            throw std::invalid_argument("base index was built for another anchor window or block size");
+        }
+
+        m_base = &base;
+
+        try {
+            diff(view_type(base.data(), 0, base.size()), rhs, sink);
+        } catch (...) {
+            m_base = nullptr;
+            throw;
+        }
+
+        m_base = nullptr;
+    }
+
+    std::vector<patch_type> diff(const basic_base_index<t_elem>& base, const view_type& rhs) {
+        std::vector<patch_type> out;
+
+        diff(base, rhs, patch_buffer { out });
+
+        return out;
+    }
+
+    // Counters of the last diff, all zero unless built with BIN_DIFF_STATS
+    DiffStats stats() const {
+        DiffStats total;
+
+        for (const auto& ctx : m_contexts) {
+            total.merge(ctx.stats);
+        }
+
+        return total;
+    }
+
+    std::vector<patch_type> diff(const view_type& lhs, const view_type& rhs) {
+        std::vector<patch_type> out;
+
+        diff(lhs, rhs, patch_buffer { out });
+
+        return out;
+    }
+
+    template <class t_sink>
+    void diff(const std::vector<t_elem>& lhs, const std::vector<t_elem>& rhs, t_sink&& sink) {
+        diff(view_type(lhs.data(), 0, lhs.size()), view_type(rhs.data(), 0, rhs.size()), sink);
+    }
+
+    std::vector<patch_type> diff(const std::vector<t_elem>& lhs, const std::vector<t_elem>& rhs) {
+        return diff(view_type(lhs.data(), 0, lhs.size()), view_type(rhs.data(), 0, rhs.size()));
+    }
+
+    // Byte diffs only, like the mapped_file overloads below
+    template <class t_sink>
+    void diff(const std::string& lhs, const std::string& rhs, t_sink&& sink) {
+        diff(view_type(lhs.c_str(), 0, lhs.size()), view_type(rhs.c_str(), 0, rhs.size()), sink);
+    }
+
+    std::vector<patch_type> diff(const std::string& lhs, const std::string& rhs) {
+        return diff(view_type(lhs.c_str(), 0, lhs.size()), view_type(rhs.c_str(), 0, rhs.size()));
+    }
+
+    // The patches view into the inputs, so temporaries would leave them dangling
+    void diff(std::string&& lhs, const std::string& rhs) = delete;
+    void diff(const std::string& lhs, std::string&& rhs) = delete;
+    void diff(std::string&& lhs, std::string&& rhs) = delete;
+    void diff(std::vector<t_elem>&& lhs, const std::vector<t_elem>& rhs) = delete;
+    void diff(const std::vector<t_elem>& lhs, std::vector<t_elem>&& rhs) = delete;
+    void diff(std::vector<t_elem>&& lhs, std::vector<t_elem>&& rhs) = delete;
+
+    // Diffs the mapped bytes in place, nothing is copied out of the mappings
+    template <class t_sink>
+    void diff(const mapped_file& lhs, const mapped_file& rhs, t_sink&& sink) {
+        diff(view_type(lhs.data(), 0, lhs.size()), view_type(rhs.data(), 0, rhs.size()), sink);
+    }
+
+    std::vector<patch_type> diff(const mapped_file& lhs, const mapped_file& rhs) {
+        return diff(view_type(lhs.data(), 0, lhs.size()), view_type(rhs.data(), 0, rhs.size()));
+    }
+
+    // The mappings are released on return, so the sink must be done with each
+    // patch, or turn it into an OwnedPatch, before it returns
+    template <class t_sink>
+    void diff_files(const std::string& lhs_path, const std::string& rhs_path, t_sink&& sink) {
+        mapped_file lhs(lhs_path);
+        mapped_file rhs(rhs_path);
+
+        diff(lhs, rhs, sink);
+    }
+
+    FileDiff diff_files(const std::string& lhs_path, const std::string& rhs_path) {
+        FileDiff result { mapped_file(lhs_path), mapped_file(rhs_path), { }, { } };
+        result.patches = diff(result.lhs, result.rhs);
+        result.stats = stats();
+
+        return result;
+    }
+};
+
+using Diff = BasicDiff<char>;
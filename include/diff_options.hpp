@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+
+// Options of a diff apart from the engine, so the library interface takes them
+// without pulling it in. cancel_token.hpp and diff_trace.hpp are installed with it,
+// so library users can make the token and the recorder these options point to.
+
+class TraceRecorder;
+class cancel_token;
+class thread_pool;
+
+struct DiffOptions {
+    // Threads for the divide and conquer, 1 keeps the whole diff on the calling thread
+    size_t threads = 1;
+
+    // Sub-problems smaller than this (lhs + rhs elements) are not split across threads
+    size_t parallel_cutoff = 1 << 16;
+
+    // Runs the parallel diff on an existing pool instead of one owned by the Diff
+    thread_pool* pool = nullptr;
+
+    // Searches over problems of at least this many elements (lhs + rhs) split the
+    // diagonals of each wide round across the pool, with a barrier after every sweep,
+    // so even the first split of a large diff uses all threads. 0 keeps every search
+    // on one thread.
+    size_t parallel_sweep = 1 << 22;
+
+    // Window of the unique anchors the input is split on before the search, 0
+    // disables them. Anchors make the result minimal only between them.
+    size_t anchor_window = 0;
+
+    // Rounds a middle snake search may take before it gives up on a minimal result,
+    // in the manner of GNU diff's too_expensive. The search then splits at the
+    // furthest reaching path it has, which bounds the time spent on inputs that have
+    // little in common. 0 searches without a bound.
+    size_t max_cost = 0;
+
+    // Block size of a coarse rsync-style match stage ahead of the search, 0 disables
+    // it. Long matches are found first, including blocks that moved, and only the
+    // gaps between them are searched. Like anchors it needs integer elements, diffs
+    // of other element types skip both.
+    size_t block_size = 0;
+
+    // Stops the diff with DiffCancelled once raised. It is checked between
+    // sub-problems and every few rounds of a search, so the diff stops promptly
+    // even inside one large search.
+    const cancel_token* cancel = nullptr;
+
+    // Point after which the diff stops with DiffCancelled, checked like cancel
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    // Time each call of diff() may take from its start, zero for no limit. It stops
+    // the diff like deadline, whichever comes first, but starts over for every call,
+    // so each pair of a batch or a tree gets the whole of it.
+    std::chrono::steady_clock::duration timeout = std::chrono::steady_clock::duration::zero();
+
+    // Called with the elements resolved so far, lhs and rhs together, and the total
+    // of both inputs. It is called about every percent and once at the end, from
+    // whichever thread resolved the elements, but never concurrently.
+    std::function<void(uint64_t resolved, uint64_t total)> progress = nullptr;
+
+    // Records the phases of the diff and its searches, see diff_trace.hpp
+    TraceRecorder* trace = nullptr;
+};
+
+// Thrown out of diff() when it was cancelled or ran past its deadline. The
+// patches already handed to the sink are valid, the rest are never produced.
+class DiffCancelled : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// Whether a patch was made by the byte diff or by the line diff
+enum class DiffKind : uint8_t {
+    Bytes,
+    Lines
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+// Counters of the search, compiled in with -DBIN_DIFF_STATS=1. Without it every
+// update is discarded at compile time and stats() stays zero.
+#ifndef BIN_DIFF_STATS
+#define BIN_DIFF_STATS 0
+#endif
+
+struct DiffStats {
+    static constexpr bool enabled = BIN_DIFF_STATS != 0;
+
+    // Middle snake searches, one per split of the divide and conquer
+    uint64_t searches = 0;
+
+    // Elements compared while following snakes, mismatches included
+    uint64_t compared = 0;
+
+    // Bytes the V arrays grew by
+    uint64_t scratch_bytes = 0;
+
+    // Time spent in the forward and the backward passes
+    uint64_t forward_ns = 0;
+    uint64_t backward_ns = 0;
+
+    // Largest D a search reached, by recursion level
+    std::vector<uint64_t> max_d = { };
+
+    void reached(size_t level, uint64_t D) {
+        if (max_d.size() <= level) {
+            max_d.resize(level + 1, 0);
+        }
+
+        max_d[level] = std::max(max_d[level], D);
+    }
+
+    void merge(const DiffStats& other) {
+        searches += other.searches;
+        compared += other.compared;
+        scratch_bytes += other.scratch_bytes;
+        forward_ns += other.forward_ns;
+        backward_ns += other.backward_ns;
+
+        for (size_t level = 0; level < other.max_d.size(); level++) {
+            reached(level, other.max_d[level]);
+        }
+    }
+
+    void write_json(std::ostream& out) const {
+        out << "{\"searches\":" << searches
+            << ",\"compared\":" << compared
+            << ",\"scratch_bytes\":" << scratch_bytes
+            << ",\"forward_ns\":" << forward_ns
+            << ",\"backward_ns\":" << backward_ns
+            << ",\"max_d\":[";
+
+        for (size_t level = 0; level < max_d.size(); level++) {
+            out << (level > 0 ? "," : "") << max_d[level];
+        }
+
+        out << "]}";
+    }
+};
+
+namespace diff_stats_detail {
+    // Adds the time between construction and stop() to a counter
+    class timer {
+        std::chrono::steady_clock::time_point m_begin;
+
+      public:
+        timer() : m_begin(std::chrono::steady_clock::now()) { }
+
+        void stop(uint64_t& ns) {
+            auto end = std::chrono::steady_clock::now();
+            ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_begin).count());
+            m_begin = end;
+        }
+    };
+
+    struct no_timer {
+        void stop(uint64_t&) { }
+    };
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Markers for profilers around the phases of a diff and the searches of its top
+// recursion levels. -DBIN_DIFF_ITT=1 emits ITT tasks for VTune, -DBIN_DIFF_SDT=1
+// emits USDT probes perf can record once added with perf probe sdt_bindiff:*. Both
+// are off by default, and a diff without a TraceRecorder then traces nothing.
+#ifndef BIN_DIFF_ITT
+#define BIN_DIFF_ITT 0
+#endif
+
+#ifndef BIN_DIFF_SDT
+#define BIN_DIFF_SDT 0
+#endif
+
+#if BIN_DIFF_ITT
+#include <ittnotify.h>
+#endif
+
+#if BIN_DIFF_SDT
+#include <sys/sdt.h>
+#endif
+
+// A span of a diff: what ran, on which thread, at which recursion level and over
+// how many elements, lhs and rhs together. Names are string literals.
+struct TraceEvent {
+    const char* name = "";
+    uint32_t thread = 0;
+    uint32_t level = 0;
+    uint64_t begin_ns = 0;
+    uint64_t duration_ns = 0;
+    uint64_t size = 0;
+};
+
+// Collects the spans of the diffs that have it as DiffOptions::trace, and of anyone
+// else who records into it, with times since the recorder was made. Diffs record
+// their phases, trim, index and myers, and a snake span per search down to
+// levels() recursion levels. Every span adds to the total of its name, but diffs
+// keep only spans over at least min_size() elements as events, so a trace stays
+// small however many anchors split a diff. Safe to share between threads.
+class TraceRecorder {
+    std::chrono::steady_clock::time_point m_start;
+    size_t m_levels;
+    uint64_t m_min_size;
+    mutable std::mutex m_mutex;
+    std::vector<TraceEvent> m_events;
+    std::vector<std::pair<const char*, uint64_t>> m_totals;
+    std::unordered_map<std::thread::id, uint32_t> m_threads;
+
+  public:
+    explicit TraceRecorder(size_t levels = 6, uint64_t min_size = 1 << 16) :
+        m_start(std::chrono::steady_clock::now()),
+        m_levels(levels),
+        m_min_size(min_size),
+        m_mutex(),
+        m_events(),
+        m_totals(),
+        m_threads()
+    {
+    }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator= (const TraceRecorder&) = delete;
+
+    size_t levels() const {
+        return m_levels;
+    }
+
+    uint64_t min_size() const {
+        return m_min_size;
+    }
+
+    uint64_t now() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+    }
+
+    // Adds the span from begin_ns to now to the total of name, and keeps it as an
+    // event of the calling thread unless event is false
+    void record(const char* name, size_t level, uint64_t begin_ns, uint64_t size, bool event = true) {
+        uint64_t end_ns = now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto total = std::find_if(m_totals.begin(), m_totals.end(), [name](const auto& t) {
+            return std::strcmp(t.first, name) == 0;
+        });
+
+        if (total == m_totals.end()) {
+            m_totals.emplace_back(name, end_ns - begin_ns);
+        } else {
+            total->second += end_ns - begin_ns;
+        }
+
+        if (event) {
+            auto thread = m_threads.emplace(std::this_thread::get_id(), static_cast<uint32_t>(m_threads.size())).first->second;
+            m_events.push_back({ name, thread, static_cast<uint32_t>(level), begin_ns, end_ns - begin_ns, size });
+        }
+    }
+
+    std::vector<TraceEvent> events() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_events;
+    }
+
+    // Time spent in all spans named name so far, kept as events or not
+    uint64_t total_ns(const char* name) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (const auto& t : m_totals) {
+            if (std::strcmp(t.first, name) == 0) {
+                return t.second;
+            }
+        }
+
+        return 0;
+    }
+
+    // The Chrome trace event format, which chrome://tracing and Perfetto load
+    void write_chrome_json(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Microseconds, with the nanoseconds as decimals
+        auto write_us = [&out](uint64_t ns) {
+            out << ns / 1000 << '.' << char('0' + ns % 1000 / 100) << char('0' + ns % 100 / 10) << char('0' + ns % 10);
+        };
+
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+        for (size_t i = 0; i < m_events.size(); i++) {
+            const TraceEvent& e = m_events[i];
+
+            out << (i > 0 ? ",\n" : "\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+                << ",\"ts\":";
+            write_us(e.begin_ns);
+            out << ",\"dur\":";
+            write_us(e.duration_ns);
+            out << ",\"args\":{\"level\":" << e.level << ",\"size\":" << e.size << "}}";
+        }
+
+        out << "\n]}\n";
+    }
+};
+
+namespace trace_detail {
+    // Levels the markers cover when no recorder sets them
+    constexpr size_t marker_levels = 6;
+
+    constexpr bool markers = BIN_DIFF_ITT != 0 || BIN_DIFF_SDT != 0;
+
+#if BIN_DIFF_ITT
+    inline __itt_domain* domain() {
+        static __itt_domain* d = __itt_domain_create("bindiff");
+        return d;
+    }
+#endif
+
+    // Traces the lifetime of the scope as a span, when there is a recorder or a
+    // marker build and level is shallow enough
+    class scope {
+        TraceRecorder* m_trace;
+        const char* m_name;
+        size_t m_level;
+        uint64_t m_size;
+        uint64_t m_begin;
+        bool m_active;
+
+      public:
+        scope(TraceRecorder* trace, const char* name, size_t level = 0, uint64_t size = 0) :
+            m_trace(trace),
+            m_name(name),
+            m_level(level),
+            m_size(size),
+            m_begin(0),
+            m_active((trace != nullptr || markers) && level < (trace != nullptr ? trace->levels() : marker_levels))
+        {
+            if (!m_active) {
+                return;
+            }
+
+#if BIN_DIFF_ITT
+            __itt_task_begin(domain(), __itt_null, __itt_null, __itt_string_handle_create(m_name));
+#endif
+#if BIN_DIFF_SDT
+            DTRACE_PROBE3(bindiff, span_begin, m_name, m_level, m_size);
+#endif
+
+            if (m_trace != nullptr) {
+                m_begin = m_trace->now();
+            }
+        }
+
+        scope(const scope&) = delete;
+        scope& operator= (const scope&) = delete;
+
+        ~scope() {
+            if (!m_active) {
+                return;
+            }
+
+            if (m_trace != nullptr) {
+                m_trace->record(m_name, m_level, m_begin, m_size, m_size >= m_trace->min_size());
+            }
+
+#if BIN_DIFF_SDT
+            DTRACE_PROBE3(bindiff, span_end, m_name, m_level, m_size);
+#endif
+#if BIN_DIFF_ITT
+            __itt_task_end(domain());
+#endif
+        }
+    };
+}
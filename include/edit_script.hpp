@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+
+#include <stdexcept>
+#include <vector>
+
+#include "diff.hpp"
+
+// The normalized form of a diff covers both inputs from start to end in one ordered
+// run of edits. Unchanged ranges are explicit Keeps. Adjacent edits of a kind are
+// merged, and a deletion and an addition at the same place become one Replace.
+enum class EditOperation {
+    Keep,
+    Insert,
+    Delete,
+    Replace,
+    Move
+};
+
+// Every edit starts where the one before it ended, in both inputs. Insert and Move
+// consume no lhs and Delete produces no rhs, so those views are empty but still
+// positioned.
+template <class t_elem>
+struct BasicEdit {
+    EditOperation op = EditOperation::Keep;
+
+    // lhs range the edit consumes
+    basic_sequence_view<t_elem> lhs = { };
+
+    // rhs range the edit produces
+    basic_sequence_view<t_elem> rhs = { };
+
+    // lhs offset a Move reads its elements from
+    size_t from = 0;
+};
+
+using Edit = BasicEdit<char>;
+
+// Sink that turns the ordered patches of a diff into its normalized edit script and
+// hands every edit on to sink. The edits of one place in the inputs are held until
+// the next unchanged range shows up, so merging costs no buffering beyond them.
+// finish() emits what is held and the unchanged tail.
+template <class t_elem, class t_sink>
+class BasicEditCoalescer {
+    using view_type = basic_sequence_view<t_elem>;
+    using patch_type = BasicPatch<t_elem>;
+    using edit_type = BasicEdit<t_elem>;
+
+    view_type m_lhs;
+    view_type m_rhs;
+    t_sink& m_sink;
+
+    // Held edits of the current place: the lhs deleted so far, and the rhs of the
+    // last run of additions or copies, which m_piece tells apart
+    view_type m_deleted;
+    view_type m_produced;
+    EditOperation m_piece;
+    size_t m_from;
+
+    static view_type empty_at(const view_type& whole, size_t at) {
+        return view_type(whole, at - whole.index_begin(), at - whole.index_begin());
+    }
+
+    void emit(EditOperation op, const view_type& lhs, const view_type& rhs, size_t from = 0) {
+        m_sink(edit_type { op, lhs, rhs, from });
+    }
+
+    // A Move leaves the deletion held, so a later addition can still replace it
+    void emit_piece() {
+        if (m_piece == EditOperation::Insert && m_deleted.size() > 0) {
+            emit(EditOperation::Replace, m_deleted, m_produced);
+            m_deleted = empty_at(m_lhs, m_deleted.index_end());
+        } else if (m_piece == EditOperation::Insert) {
+            emit(EditOperation::Insert, m_deleted, m_produced);
+        } else if (m_piece == EditOperation::Move) {
+            emit(EditOperation::Move, empty_at(m_lhs, m_deleted.index_begin()), m_produced, m_from);
+        }
+
+        m_piece = EditOperation::Keep;
+        m_produced = empty_at(m_rhs, m_produced.index_end());
+    }
+
+    void flush() {
+        emit_piece();
+
+        if (m_deleted.size() > 0) {
+            emit(EditOperation::Delete, m_deleted, m_produced);
+            m_deleted = empty_at(m_lhs, m_deleted.index_end());
+        }
+    }
+
+    // Emits the unchanged range up to at, an offset in the input held ends in. The
+    // other input advances by as much.
+    void keep_to(size_t at, const view_type& held) {
+        if (at < held.index_end()) {
+            throw std::invalid_argument("patches are not an ordered edit script");
+        }
+
+        size_t n = at - held.index_end();
+
+        if (n == 0) {
+            return;
+        }
+
+        flush();
+
+        size_t lhs_at = m_deleted.index_end();
+        size_t rhs_at = m_produced.index_end();
+
+        if (n > m_lhs.index_end() - lhs_at || n > m_rhs.index_end() - rhs_at) {
+            throw std::invalid_argument("patches run past the end of their inputs");
+        }
+
+        emit(EditOperation::Keep, view_type(m_lhs, lhs_at - m_lhs.index_begin(), lhs_at + n - m_lhs.index_begin()),
+            view_type(m_rhs, rhs_at - m_rhs.index_begin(), rhs_at + n - m_rhs.index_begin()));
+
+        m_deleted = empty_at(m_lhs, lhs_at + n);
+        m_produced = empty_at(m_rhs, rhs_at + n);
+    }
+
+  public:
+    // lhs and rhs are the whole inputs of the diff
+    BasicEditCoalescer(const view_type& lhs, const view_type& rhs, t_sink& sink) :
+        m_lhs(lhs),
+        m_rhs(rhs),
+        m_sink(sink),
+        m_deleted(empty_at(lhs, lhs.index_begin())),
+        m_produced(empty_at(rhs, rhs.index_begin())),
+        m_piece(EditOperation::Keep),
+        m_from(0)
+    { }
+
+    BasicEditCoalescer(const BasicEditCoalescer&) = delete;
+    BasicEditCoalescer& operator= (const BasicEditCoalescer&) = delete;
+
+    void operator() (const patch_type& p) {
+        if (p.size() == 0) {
+            return;
+        }
+
+        if (p.GetOperation() == PatchOperation::Deletion) {
+            keep_to(p.offset(), m_deleted);
+            m_deleted = m_deleted.combine(p.view());
+        } else if (p.GetOperation() == PatchOperation::Addition) {
+            keep_to(p.offset(), m_produced);
+
+            if (m_piece != EditOperation::Insert) {
+                emit_piece();
+                m_piece = EditOperation::Insert;
+            }
+
+            m_produced = m_produced.combine(p.view());
+        } else if (p.GetOperation() == PatchOperation::Copy) {
+            keep_to(p.offset(), m_produced);
+
+            // Copies merge when their lhs ranges follow each other as well
+            if (m_piece != EditOperation::Move || m_from + m_produced.size() != p.from()) {
+                emit_piece();
+                m_piece = EditOperation::Move;
+                m_from = p.from();
+            }
+
+            m_produced = m_produced.combine(p.view());
+        } else {
+            throw std::invalid_argument("cannot coalesce an undefined patch");
+        }
+    }
+
+    // Emits the held edits and the unchanged rest of both inputs
+    void finish() {
+        flush();
+
+        size_t lhs_at = m_deleted.index_end();
+        size_t rhs_at = m_produced.index_end();
+
+        if (m_lhs.index_end() - lhs_at != m_rhs.index_end() - rhs_at) {
+            throw std::invalid_argument("patches do not cover their inputs");
+        }
+
+        keep_to(m_lhs.index_end(), m_deleted);
+    }
+};
+
+// Normalized edit script of the patches of a diff of lhs and rhs
+template <class t_elem>
+std::vector<BasicEdit<t_elem>> normalize(const basic_sequence_view<t_elem>& lhs, const basic_sequence_view<t_elem>& rhs, const std::vector<BasicPatch<t_elem>>& patches) {
+    std::vector<BasicEdit<t_elem>> edits;
+    auto sink = [&edits](const BasicEdit<t_elem>& e) {
+        edits.push_back(e);
+    };
+
+    BasicEditCoalescer<t_elem, decltype(sink)> coalescer(lhs, rhs, sink);
+
+    for (const auto& p : patches) {
+        coalescer(p);
+    }
+
+    coalescer.finish();
+
+    return edits;
+}
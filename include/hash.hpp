@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// XXH64, streaming. Matches the reference implementation bit for bit, so hashes
+// written into patches can be checked with any xxHash tool.
+class xxhash64 {
+    static constexpr uint64_t prime1 = 11400714785074694791ull;
+    static constexpr uint64_t prime2 = 14029467366897019727ull;
+    static constexpr uint64_t prime3 = 1609587929392839161ull;
+    static constexpr uint64_t prime4 = 9650029242287828579ull;
+    static constexpr uint64_t prime5 = 2870177450012600261ull;
+
+    uint64_t m_seed;
+    uint64_t m_acc[4];
+    unsigned char m_buffer[32];
+    size_t m_buffered;
+    uint64_t m_length;
+
+    static uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t read64(const unsigned char* p) {
+        uint64_t x;
+        std::memcpy(&x, p, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        x = __builtin_bswap64(x);
+#endif
+        return x;
+    }
+
+    static uint64_t read32(const unsigned char* p) {
+        uint32_t x;
+        std::memcpy(&x, p, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        x = __builtin_bswap32(x);
+#endif
+        return x;
+    }
+
+    static uint64_t round(uint64_t acc, uint64_t input) {
+        return rotl(acc + input * prime2, 31) * prime1;
+    }
+
+    static uint64_t merge(uint64_t h, uint64_t acc) {
+        return (h ^ round(0, acc)) * prime1 + prime4;
+    }
+
+    void consume(const unsigned char* p) {
+        for (int i = 0; i < 4; i++) {
+            m_acc[i] = round(m_acc[i], read64(p + 8 * i));
+        }
+    }
+
+  public:
+    explicit xxhash64(uint64_t seed = 0) : m_seed(seed), m_acc(), m_buffer(), m_buffered(0), m_length(0) {
+        m_acc[0] = seed + prime1 + prime2;
+        m_acc[1] = seed + prime2;
+        m_acc[2] = seed;
+        m_acc[3] = seed - prime1;
+    }
+
+    void update(const void* data, size_t size) {
+        auto p = static_cast<const unsigned char*>(data);
+        m_length += size;
+
+        if (m_buffered > 0) {
+            size_t n = size < 32 - m_buffered ? size : 32 - m_buffered;
+            std::memcpy(m_buffer + m_buffered, p, n);
+            m_buffered += n;
+            p += n;
+            size -= n;
+
+            if (m_buffered < 32) {
+                return;
+            }
+
+            consume(m_buffer);
+            m_buffered = 0;
+        }
+
+        for (; size >= 32; p += 32, size -= 32) {
+            consume(p);
+        }
+
+        std::memcpy(m_buffer, p, size);
+        m_buffered = size;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+
+        if (m_length >= 32) {
+            h = rotl(m_acc[0], 1) + rotl(m_acc[1], 7) + rotl(m_acc[2], 12) + rotl(m_acc[3], 18);
+
+            for (int i = 0; i < 4; i++) {
+                h = merge(h, m_acc[i]);
+            }
+        } else {
+            h = m_seed + prime5;
+        }
+
+        h += m_length;
+
+        const unsigned char* p = m_buffer;
+        size_t size = m_buffered;
+
+        for (; size >= 8; p += 8, size -= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * prime1 + prime4;
+        }
+
+        if (size >= 4) {
+            h ^= read32(p) * prime1;
+            h = rotl(h, 23) * prime2 + prime3;
+            p += 4;
+            size -= 4;
+        }
+
+        for (; size > 0; p++, size--) {
+            h ^= *p * prime5;
+            h = rotl(h, 11) * prime1;
+        }
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+
+        return h;
+    }
+
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = 0) {
+        xxhash64 h(seed);
+        h.update(data, size);
+        return h.digest();
+    }
+};
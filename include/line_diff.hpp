@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "diff.hpp"
+#include "hash.hpp"
+#include "thread_pool.hpp"
+
+namespace line_detail {
+    struct line {
+        size_t begin;
+        size_t size;
+        uint64_t hash;
+    };
+
+    // Lines end after their '\n', the last one may have none
+    inline void split_lines(const char* data, size_t begin, size_t end, std::vector<line>& out) {
+        while (begin < end) {
+            auto newline = static_cast<const char*>(std::memchr(data + begin, '\n', end - begin));
+            size_t next = newline != nullptr ? static_cast<size_t>(newline - data) + 1 : end;
+
+            out.push_back({ begin, next - begin, xxhash64::hash(data + begin, next - begin) });
+            begin = next;
+        }
+    }
+
+    // Chunk boundaries at roughly even offsets, each moved up to just past a '\n'
+    inline std::vector<size_t> chunk_bounds(const char* data, size_t size, size_t chunks) {
+        std::vector<size_t> bounds { 0 };
+
+        for (size_t i = 1; i < chunks; i++) {
+            size_t at = std::max(bounds.back(), size / chunks * i);
+            auto newline = at < size ? static_cast<const char*>(std::memchr(data + at, '\n', size - at)) : nullptr;
+
+            bounds.push_back(newline != nullptr ? static_cast<size_t>(newline - data) + 1 : size);
+        }
+
+        bounds.push_back(size);
+
+        return bounds;
+    }
+}
+
+// Maps equal lines to equal dense IDs. Open addressing over the line hashes, sized
+// up front for the number of lines so it never rehashes.
+class line_interner {
+    struct slot {
+        uint64_t hash;
+        uint32_t id;
+    };
+
+    struct entry {
+        const char* data;
+        size_t size;
+    };
+
+    std::vector<slot> m_slots;
+    std::vector<entry> m_entries;
+    unsigned m_shift;
+
+    size_t slot_of(uint64_t hash) const {
+        return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ull) >> m_shift);
+    }
+
+  public:
+    explicit line_interner(size_t lines) : m_slots(), m_entries(), m_shift(64) {
+        size_t capacity = 1;
+
+        while (capacity < 2 * lines) {
+            capacity *= 2;
+            m_shift--;
+        }
+
+        m_slots.assign(capacity, slot { 0, 0 });
+    }
+
+    // IDs are numbered from 1 in the slots, 0 marks an empty one
+    uint32_t intern(const char* data, size_t size, uint64_t hash) {
+        size_t mask = m_slots.size() - 1;
+
+        for (size_t i = slot_of(hash); ; i = (i + 1) & mask) {
+            if (m_slots[i].id == 0) {
+                if (m_entries.size() == std::numeric_limits<uint32_t>::max()) {
+                    throw std::length_error("too many distinct lines for 32-bit line IDs");
+                }
+
+                m_entries.push_back({ data, size });
+                m_slots[i] = { hash, static_cast<uint32_t>(m_entries.size()) };
+                return m_slots[i].id - 1;
+            }
+
+            const entry& e = m_entries[m_slots[i].id - 1];
+
+            if (m_slots[i].hash == hash && e.size == size && std::memcmp(e.data, data, size) == 0) {
+                return m_slots[i].id - 1;
+            }
+        }
+    }
+
+    size_t size() const {
+        return m_entries.size();
+    }
+};
+
+// Line-level diff of text. Both inputs are split into lines and every line is
+// interned into a uint32_t ID, so the search compares integers instead of lines.
+// Splitting and hashing run in parallel over chunks of the inputs. Patches come
+// out as byte Patches that cover whole lines, so they encode and apply like any
+// other diff.
+class LineDiff {
+    static constexpr size_t chunk_size = 1 << 20;
+
+    std::unique_ptr<thread_pool> m_owned_pool;
+    thread_pool* m_pool;
+    BasicDiff<uint32_t> m_diff;
+
+    static DiffOptions shared_pool(DiffOptions options, thread_pool* pool) {
+        options.pool = pool;
+        return options;
+    }
+
+    static thread_pool* make_pool(const DiffOptions& options, std::unique_ptr<thread_pool>& owned) {
+        if (options.pool == nullptr && options.threads > 1) {
+            owned = std::make_unique<thread_pool>(options.threads);
+        }
+
+        return options.pool != nullptr ? options.pool : owned.get();
+    }
+
+    std::vector<line_detail::line> split(const char* data, size_t size) {
+        std::vector<line_detail::line> lines;
+        size_t chunks = (size + chunk_size - 1) / chunk_size;
+
+        if (m_pool == nullptr || chunks < 2) {
+            line_detail::split_lines(data, 0, size, lines);
+            return lines;
+        }
+
+        auto bounds = line_detail::chunk_bounds(data, size, chunks);
+        std::vector<std::vector<line_detail::line>> parts(chunks);
+
+        {
+            task_group group(*m_pool);
+
+            for (size_t i = 0; i < chunks; i++) {
+                group.run([data, &bounds, &parts, i] {
+                    line_detail::split_lines(data, bounds[i], bounds[i + 1], parts[i]);
+                });
+            }
+
+            group.wait();
+        }
+
+        for (const auto& part : parts) {
+            lines.insert(lines.end(), part.begin(), part.end());
+        }
+
+        return lines;
+    }
+
+    static std::vector<uint32_t> intern(line_interner& interner, const char* data, const std::vector<line_detail::line>& lines) {
+        std::vector<uint32_t> ids;
+        ids.reserve(lines.size());
+
+        for (const auto& l : lines) {
+            ids.push_back(interner.intern(data + l.begin, l.size, l.hash));
+        }
+
+        return ids;
+    }
+
+    // Byte offset of line i, one past the last line is the end of the input
+    static size_t line_offset(const std::vector<line_detail::line>& lines, size_t i, size_t size) {
+        return i < lines.size() ? lines[i].begin : size;
+    }
+
+  public:
+    LineDiff() : LineDiff(DiffOptions()) { }
+
+    explicit LineDiff(const DiffOptions& options) :
+        m_owned_pool(),
+        m_pool(make_pool(options, m_owned_pool)),
+        m_diff(shared_pool(options, m_pool))
+    { }
+
+    LineDiff(const LineDiff&) = delete;
+    LineDiff& operator= (const LineDiff&) = delete;
+
+    // Hands every patch to sink in order. Anchor windows and block sizes in the
+    // options count lines here.
+    template <class t_sink>
+    void diff(const sequence_view& lhs, const sequence_view& rhs, t_sink&& sink) {
+        auto lhs_lines = split(lhs.begin(), lhs.size());
+        auto rhs_lines = split(rhs.begin(), rhs.size());
+
+        line_interner interner(lhs_lines.size() + rhs_lines.size());
+        auto lhs_ids = intern(interner, lhs.begin(), lhs_lines);
+        auto rhs_ids = intern(interner, rhs.begin(), rhs_lines);
+
+        m_diff.diff(lhs_ids, rhs_ids, [&](const BasicPatch<uint32_t>& p) {
+            bool from_rhs = p.source() == PatchSource::Rhs;
+            const auto& lines = from_rhs ? rhs_lines : lhs_lines;
+            const auto& seq = from_rhs ? rhs : lhs;
+
+            sequence_view bytes(seq, line_offset(lines, p.offset(), seq.size()), line_offset(lines, p.offset() + p.size(), seq.size()));
+
+            if (p.GetOperation() == PatchOperation::Deletion) {
+                sink(Patch::make_deletion(bytes));
+            } else if (p.GetOperation() == PatchOperation::Addition) {
+                sink(Patch::make_addition(bytes));
+            } else {
+                sink(Patch::make_copy(bytes, lhs.index_begin() + line_offset(lhs_lines, p.from(), lhs.size())));
+            }
+        });
+    }
+
+    // Counters of the last diff, all zero unless built with BIN_DIFF_STATS
+    DiffStats stats() const {
+        return m_diff.stats();
+    }
+
+    std::vector<Patch> diff(const sequence_view& lhs, const sequence_view& rhs) {
+        std::vector<Patch> out;
+
+        diff(lhs, rhs, [&out](const Patch& p) {
+            out.push_back(p);
+        });
+
+        return out;
+    }
+
+    template <class t_sink>
+    void diff(const mapped_file& lhs, const mapped_file& rhs, t_sink&& sink) {
+        diff(sequence_view(lhs.data(), 0, lhs.size()), sequence_view(rhs.data(), 0, rhs.size()), sink);
+    }
+
+    std::vector<Patch> diff(const std::string& lhs, const std::string& rhs) {
+        return diff(sequence_view(lhs.c_str(), 0, lhs.size()), sequence_view(rhs.c_str(), 0, rhs.size()));
+    }
+
+    // The patches view into the strings, so temporaries would leave them dangling
+    void diff(std::string&& lhs, const std::string& rhs) = delete;
+    void diff(const std::string& lhs, std::string&& rhs) = delete;
+    void diff(std::string&& lhs, std::string&& rhs) = delete;
+};
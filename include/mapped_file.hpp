@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cstddef>
+
+#include <string>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. The mapping lives as long as the
+// object, so views built over data() must not outlive it.
+class mapped_file {
+    const char* m_data;
+    size_t m_size;
+
+    static std::system_error make_error(const std::string& path) {
+#ifdef _WIN32
+        return std::system_error(static_cast<int>(GetLastError()), std::system_category(), path);
+#else
+        return std::system_error(errno, std::generic_category(), path);
+#endif
+    }
+
+    void unmap() noexcept {
+        if (m_data != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(m_data);
+#else
+            munmap(const_cast<char*>(m_data), m_size);
+#endif
+        }
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+  public:
+    mapped_file() : m_data(nullptr), m_size(0) { }
+
+    explicit mapped_file(const std::string& path) : m_data(nullptr), m_size(0) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE) {
+            throw make_error(path);
+        }
+
+        LARGE_INTEGER size;
+
+        if (!GetFileSizeEx(file, &size)) {
+            auto error = make_error(path);
+            CloseHandle(file);
+            throw error;
+        }
+
+        if (size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+            if (mapping == nullptr) {
+                auto error = make_error(path);
+                CloseHandle(file);
+                throw error;
+            }
+
+            // The view keeps the mapping object alive after its handle is closed
+            m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+
+            if (m_data == nullptr) {
+                auto error = make_error(path);
+                CloseHandle(file);
+                throw error;
+            }
+
+            m_size = static_cast<size_t>(size.QuadPart);
+        }
+
+        CloseHandle(file);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            throw make_error(path);
+        }
+
+        struct stat st;
+
+        if (fstat(fd, &st) != 0) {
+            auto error = make_error(path);
+            close(fd);
+            throw error;
+        }
+
+        // mmap rejects zero-length mappings, an empty file is just an empty view
+        if (st.st_size > 0) {
+            void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (data == MAP_FAILED) {
+                auto error = make_error(path);
+                close(fd);
+                throw error;
+            }
+
+            m_data = static_cast<const char*>(data);
+            m_size = static_cast<size_t>(st.st_size);
+        }
+
+        close(fd);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator= (const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept :
+        m_data(std::exchange(other.m_data, nullptr)),
+        m_size(std::exchange(other.m_size, 0))
+    { }
+
+    mapped_file& operator= (mapped_file&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+        }
+
+        return *this;
+    }
+
+    ~mapped_file() {
+        unmap();
+    }
+
+    const char* data() const noexcept {
+        return m_data;
+    }
+
+    size_t size() const noexcept {
+        return m_size;
+    }
+};
+
+// Read-write mapping of a file created, or truncated, to a fixed size. Writes land
+// in the file when the mapping is flushed or released.
+class mapped_output {
+    char* m_data;
+    size_t m_size;
+
+    void unmap() noexcept {
+        if (m_data != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(m_data);
+#else
+            munmap(m_data, m_size);
+#endif
+        }
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+  public:
+    mapped_output(const std::string& path, size_t size) : m_data(nullptr), m_size(0) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), path);
+        }
+
+        if (size > 0) {
+            LARGE_INTEGER end;
+            end.QuadPart = static_cast<LONGLONG>(size);
+            HANDLE mapping = nullptr;
+
+            if (SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file)) {
+                mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+            }
+
+            if (mapping != nullptr) {
+                m_data = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+
+            if (m_data == nullptr) {
+                auto error = std::system_error(static_cast<int>(GetLastError()), std::system_category(), path);
+                CloseHandle(file);
+                throw error;
+            }
+
+            m_size = size;
+        }
+
+        CloseHandle(file);
+#else
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        if (size > 0) {
+            void* data = MAP_FAILED;
+
+            if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+                data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+
+            if (data == MAP_FAILED) {
+                auto error = std::system_error(errno, std::generic_category(), path);
+                close(fd);
+                throw error;
+            }
+
+            m_data = static_cast<char*>(data);
+            m_size = size;
+        }
+
+        close(fd);
+#endif
+    }
+
+    mapped_output(const mapped_output&) = delete;
+    mapped_output& operator= (const mapped_output&) = delete;
+
+    ~mapped_output() {
+        unmap();
+    }
+
+    char* data() noexcept {
+        return m_data;
+    }
+
+    size_t size() const noexcept {
+        return m_size;
+    }
+
+    void flush() {
+        if (m_data == nullptr) {
+            return;
+        }
+
+#ifdef _WIN32
+        if (!FlushViewOfFile(m_data, 0)) {
+            throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "flush");
+        }
+#else
+        if (msync(m_data, m_size, MS_SYNC) != 0) {
+            throw std::system_error(errno, std::generic_category(), "msync");
+        }
+#endif
+    }
+};
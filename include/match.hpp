@@ -0,0 +1,356 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Match-length kernels for the snake loops. match_forward counts the common prefix
+// of a[0, n) and b[0, n), match_backward the common suffix of the n bytes ending at
+// a_end and b_end. Both only read inside those ranges.
+
+// On x86-64 the byte kernels pick AVX2 or AVX-512 at run time, so a build for the
+// baseline ISA still uses the widest compares the machine has. -DBIN_DIFF_DISPATCH=0
+// keeps what the compiler targets.
+#ifndef BIN_DIFF_DISPATCH
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(__AVX512BW__)
+#define BIN_DIFF_DISPATCH 1
+#else
+#define BIN_DIFF_DISPATCH 0
+#endif
+#endif
+
+namespace match_detail {
+    inline unsigned count_trailing_zeros(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long i;
+        _BitScanForward64(&i, x);
+        return static_cast<unsigned>(i);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+    }
+
+    inline unsigned count_leading_zeros(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long i;
+        _BitScanReverse64(&i, x);
+        return 63 - static_cast<unsigned>(i);
+#else
+        return static_cast<unsigned>(__builtin_clzll(x));
+#endif
+    }
+
+    inline uint64_t load64(const char* p) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        return word;
+    }
+
+    // Bytes a and b share from the low address up, given their differing bits
+    inline size_t low_bytes_equal(uint64_t diff) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return count_leading_zeros(diff) / 8;
+#else
+        return count_trailing_zeros(diff) / 8;
+#endif
+    }
+
+    // Bytes a and b share from the high address down, given their differing bits
+    inline size_t high_bytes_equal(uint64_t diff) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return count_trailing_zeros(diff) / 8;
+#else
+        return count_leading_zeros(diff) / 8;
+#endif
+    }
+
+#if defined(__ARM_NEON)
+    // Four bits per byte lane, set where the lanes are equal
+    inline uint64_t neon_equal_mask(const char* a, const char* b) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(a)), vld1q_u8(reinterpret_cast<const uint8_t*>(b)));
+        return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    }
+#endif
+
+    // Built for the ISA the compiler targets
+    inline size_t forward_portable(const char* a, const char* b, size_t n) {
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        for (; i + 32 <= n; i += 32) {
+            __m256i eq = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))
+            );
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+
+            if (mask != 0xFFFFFFFFu) {
+                return i + count_trailing_zeros(~mask);
+            }
+        }
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; i + 16 <= n; i += 16) {
+            __m128i eq = _mm_cmpeq_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))
+            );
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(eq));
+
+            if (mask != 0xFFFFu) {
+                return i + count_trailing_zeros(~mask);
+            }
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 16 <= n; i += 16) {
+            uint64_t mask = neon_equal_mask(a + i, b + i);
+
+            if (mask != ~uint64_t(0)) {
+                return i + count_trailing_zeros(~mask) / 4;
+            }
+        }
+#endif
+
+        for (; i + 8 <= n; i += 8) {
+            uint64_t diff = load64(a + i) ^ load64(b + i);
+
+            if (diff != 0) {
+                return i + low_bytes_equal(diff);
+            }
+        }
+
+        while (i < n && a[i] == b[i]) {
+            i++;
+        }
+
+        return i;
+    }
+
+    inline size_t backward_portable(const char* a_end, const char* b_end, size_t n) {
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        for (; i + 32 <= n; i += 32) {
+            __m256i eq = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a_end - i - 32)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b_end - i - 32))
+            );
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+
+            if (mask != 0xFFFFFFFFu) {
+                return i + count_leading_zeros(uint64_t(~mask) << 32);
+            }
+        }
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; i + 16 <= n; i += 16) {
+            __m128i eq = _mm_cmpeq_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(a_end - i - 16)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(b_end - i - 16))
+            );
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(eq));
+
+            if (mask != 0xFFFFu) {
+                return i + count_leading_zeros(uint64_t(~mask & 0xFFFFu) << 48);
+            }
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 16 <= n; i += 16) {
+            uint64_t mask = neon_equal_mask(a_end - i - 16, b_end - i - 16);
+
+            if (mask != ~uint64_t(0)) {
+                return i + count_leading_zeros(~mask) / 4;
+            }
+        }
+#endif
+
+        for (; i + 8 <= n; i += 8) {
+            uint64_t diff = load64(a_end - i - 8) ^ load64(b_end - i - 8);
+
+            if (diff != 0) {
+                return i + high_bytes_equal(diff);
+            }
+        }
+
+        while (i < n && a_end[-static_cast<ptrdiff_t>(i) - 1] == b_end[-static_cast<ptrdiff_t>(i) - 1]) {
+            i++;
+        }
+
+        return i;
+    }
+
+#if BIN_DIFF_DISPATCH
+    __attribute__((target("avx2")))
+    inline size_t forward_avx2(const char* a, const char* b, size_t n) {
+        size_t i = 0;
+
+        for (; i + 32 <= n; i += 32) {
+            __m256i eq = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))
+            );
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+
+            if (mask != 0xFFFFFFFFu) {
+                return i + count_trailing_zeros(~mask);
+            }
+        }
+
+        return i + forward_portable(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t backward_avx2(const char* a_end, const char* b_end, size_t n) {
+        size_t i = 0;
+
+        for (; i + 32 <= n; i += 32) {
+            __m256i eq = _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a_end - i - 32)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b_end - i - 32))
+            );
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+
+            if (mask != 0xFFFFFFFFu) {
+                return i + count_leading_zeros(uint64_t(~mask) << 32);
+            }
+        }
+
+        return i + backward_portable(a_end - i, b_end - i, n - i);
+    }
+
+    __attribute__((target("avx512bw")))
+    inline size_t forward_avx512(const char* a, const char* b, size_t n) {
+        size_t i = 0;
+
+        for (; i + 64 <= n; i += 64) {
+            uint64_t mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+
+            if (mask != ~uint64_t(0)) {
+                return i + count_trailing_zeros(~mask);
+            }
+        }
+
+        return i + forward_avx2(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx512bw")))
+    inline size_t backward_avx512(const char* a_end, const char* b_end, size_t n) {
+        size_t i = 0;
+
+        for (; i + 64 <= n; i += 64) {
+            uint64_t mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(a_end - i - 64), _mm512_loadu_si512(b_end - i - 64));
+
+            if (mask != ~uint64_t(0)) {
+                return i + count_leading_zeros(~mask);
+            }
+        }
+
+        return i + backward_avx2(a_end - i, b_end - i, n - i);
+    }
+
+    using kernel = size_t (*)(const char*, const char*, size_t);
+
+    inline kernel pick(kernel avx512, kernel avx2, kernel portable) {
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512bw")) {
+            return avx512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            return avx2;
+        }
+
+        return portable;
+    }
+
+    inline kernel forward_kernel() {
+        static const kernel k = pick(forward_avx512, forward_avx2, forward_portable);
+        return k;
+    }
+
+    inline kernel backward_kernel() {
+        static const kernel k = pick(backward_avx512, backward_avx2, backward_portable);
+        return k;
+    }
+
+    // Below this the call through the kernel pointer costs more than the wide compares save
+    constexpr size_t dispatch_size = 64;
+#endif
+}
+
+inline size_t match_forward(const char* a, const char* b, size_t n) {
+    using namespace match_detail;
+
+#if BIN_DIFF_DISPATCH
+    // Most snakes end within their first word, which is checked before any call
+    if (n >= dispatch_size) {
+        uint64_t diff = load64(a) ^ load64(b);
+        return diff != 0 ? low_bytes_equal(diff) : forward_kernel()(a, b, n);
+    }
+#endif
+
+    return forward_portable(a, b, n);
+}
+
+inline size_t match_backward(const char* a_end, const char* b_end, size_t n) {
+    using namespace match_detail;
+
+#if BIN_DIFF_DISPATCH
+    if (n >= dispatch_size) {
+        uint64_t diff = load64(a_end - 8) ^ load64(b_end - 8);
+        return diff != 0 ? high_bytes_equal(diff) : backward_kernel()(a_end, b_end, n);
+    }
+#endif
+
+    return backward_portable(a_end, b_end, n);
+}
+
+// Element-wise versions for the other element types of the diff. Overload resolution
+// prefers the byte kernels above for char, so the byte path keeps its inner loop.
+template <class t_elem>
+size_t match_forward(const t_elem* a, const t_elem* b, size_t n) {
+    size_t i = 0;
+
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+
+    return i;
+}
+
+template <class t_elem>
+size_t match_backward(const t_elem* a_end, const t_elem* b_end, size_t n) {
+    size_t i = 0;
+
+    while (i < n && a_end[-static_cast<ptrdiff_t>(i) - 1] == b_end[-static_cast<ptrdiff_t>(i) - 1]) {
+        i++;
+    }
+
+    return i;
+}
+
+// Comparison policy of the diff. Elements are equal when they compare equal with ==,
+// a policy for tokens that compare otherwise provides both members itself.
+template <class t_elem>
+struct element_traits {
+    static size_t match_forward(const t_elem* a, const t_elem* b, size_t n) {
+        return ::match_forward(a, b, n);
+    }
+
+    static size_t match_backward(const t_elem* a_end, const t_elem* b_end, size_t n) {
+        return ::match_backward(a_end, b_end, n);
+    }
+};
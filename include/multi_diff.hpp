@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include "base_index.hpp"
+#include "diff.hpp"
+#include "edit_script.hpp"
+#include "hash.hpp"
+#include "patch_format.hpp"
+#include "thread_pool.hpp"
+
+// How a region of the base fared in a three-way diff
+enum class MergeChange {
+    // Changed on our side only
+    Ours,
+
+    // Changed on their side only
+    Theirs,
+
+    // Changed on both sides to the same result
+    Both,
+
+    // Changed on both sides differently
+    Conflict
+};
+
+// A region of the base that one side or both changed, and the ranges the sides made
+// of it, all [begin, end) offsets into their own inputs. The regions between hunks
+// are unchanged on both sides.
+struct MergeHunk {
+    MergeChange change = MergeChange::Conflict;
+    size_t base_begin = 0;
+    size_t base_end = 0;
+    size_t ours_begin = 0;
+    size_t ours_end = 0;
+    size_t theirs_begin = 0;
+    size_t theirs_end = 0;
+};
+
+namespace multi_detail {
+    // A base range one side replaced, and what it put there
+    struct change {
+        size_t base_begin;
+        size_t base_end;
+        size_t target_begin;
+        size_t target_end;
+    };
+
+    // The changed ranges of a normalized edit script, the edits touching each other
+    // joined. Moves count as additions, where their bytes come from does not matter.
+    inline std::vector<change> changes_of(const std::vector<Edit>& edits) {
+        std::vector<change> changes;
+
+        for (const auto& e : edits) {
+            if (e.op == EditOperation::Keep) {
+                continue;
+            }
+
+            size_t base = e.lhs.index_begin();
+            size_t target = e.rhs.index_begin();
+
+            if (!changes.empty() && changes.back().base_end == base && changes.back().target_end == target) {
+                changes.back().base_end = base + e.lhs.size();
+                changes.back().target_end = target + e.rhs.size();
+            } else {
+                changes.push_back({ base, base + e.lhs.size(), target, target + e.rhs.size() });
+            }
+        }
+
+        return changes;
+    }
+
+    // The diff3 merge of the changes of both sides. Changes of the two sides that
+    // overlap or touch on the base make one hunk, which conflicts unless both sides
+    // ended up with the same bytes for it.
+    inline std::vector<MergeHunk> merge(const sequence_view& ours, const sequence_view& theirs, const std::vector<change>& our_changes,
+        const std::vector<change>& their_changes)
+    {
+        std::vector<MergeHunk> hunks;
+
+        // The last change taken of each side, unchanged ranges map through its end
+        change our_last = { 0, 0, 0, 0 };
+        change their_last = { 0, 0, 0, 0 };
+        size_t i = 0;
+        size_t j = 0;
+
+        // Range of the hunk [lo, hi) on one side, whose changes in it are [first, last)
+        auto side = [](const std::vector<change>& changes, size_t first, size_t last, change& previous, size_t lo, size_t hi,
+            size_t& begin, size_t& end)
+        {
+            if (first == last) {
+                begin = previous.target_end + (lo - previous.base_end);
+                end = begin + (hi - lo);
+                return;
+            }
+
+            begin = changes[first].target_begin - (changes[first].base_begin - lo);
+            end = changes[last - 1].target_end + (hi - changes[last - 1].base_end);
+            previous = changes[last - 1];
+        };
+
+        while (i < our_changes.size() || j < their_changes.size()) {
+            bool ours_first = j == their_changes.size() || (i < our_changes.size() && our_changes[i].base_begin <= their_changes[j].base_begin);
+            size_t lo = ours_first ? our_changes[i].base_begin : their_changes[j].base_begin;
+            size_t hi = lo;
+            size_t first_i = i;
+            size_t first_j = j;
+
+            for (;;) {
+                if (i < our_changes.size() && our_changes[i].base_begin <= hi) {
+                    hi = std::max(hi, our_changes[i++].base_end);
+                } else if (j < their_changes.size() && their_changes[j].base_begin <= hi) {
+                    hi = std::max(hi, their_changes[j++].base_end);
+                } else {
+                    break;
+                }
+            }
+
+            MergeHunk h;
+            h.base_begin = lo;
+            h.base_end = hi;
+            side(our_changes, first_i, i, our_last, lo, hi, h.ours_begin, h.ours_end);
+            side(their_changes, first_j, j, their_last, lo, hi, h.theirs_begin, h.theirs_end);
+
+            if (first_j == j) {
+                h.change = MergeChange::Ours;
+            } else if (first_i == i) {
+                h.change = MergeChange::Theirs;
+            } else if (h.ours_end - h.ours_begin == h.theirs_end - h.theirs_begin &&
+                std::equal(ours.begin() + h.ours_begin, ours.begin() + h.ours_end, theirs.begin() + h.theirs_begin)) {
+                h.change = MergeChange::Both;
+            } else {
+                h.change = MergeChange::Conflict;
+            }
+
+            hunks.push_back(h);
+        }
+
+        return hunks;
+    }
+}
+
+inline const char* to_string(MergeChange change) {
+    switch (change) {
+        case MergeChange::Ours: return "ours";
+        case MergeChange::Theirs: return "theirs";
+        case MergeChange::Both: return "both";
+        case MergeChange::Conflict: return "conflict";
+    }
+
+    return "unknown";
+}
+
+// Diffs one base against many targets, like a release image against the build of
+// every device. The base is indexed once and all targets are diffed against that
+// index, each on one lane, the pool workers and the calling thread. A lane keeps its
+// Diff across the targets it takes, and the Diffs share the pool for their searches,
+// so fewer targets than threads still use every thread.
+class MultiDiff {
+    DiffOptions m_options;
+    std::unique_ptr<thread_pool> m_owned_pool;
+    thread_pool* m_pool;
+
+    // One per lane
+    std::vector<std::unique_ptr<Diff>> m_diffs;
+
+    // Calls job(diff, i) for every target i, the lanes take the targets in order
+    template <class t_job>
+    void run(size_t targets, t_job& job) {
+        std::atomic<size_t> next(0);
+        size_t lanes = std::min(m_diffs.size(), targets);
+
+        auto lane = [this, &job, &next, targets](size_t l) {
+            for (size_t i; (i = next++) < targets; ) {
+                job(*m_diffs[l], i);
+            }
+        };
+
+        if (lanes <= 1) {
+            lane(0);
+            return;
+        }
+
+        task_group group(*m_pool);
+
+        for (size_t l = 1; l < lanes; l++) {
+            group.run([&lane, l] { lane(l); });
+        }
+
+        lane(0);
+        group.wait();
+    }
+
+  public:
+    MultiDiff() : MultiDiff(DiffOptions()) { }
+
+    explicit MultiDiff(const DiffOptions& options) :
+        m_options(options),
+        m_owned_pool(),
+        m_pool(options.pool),
+        m_diffs()
+    {
+        if (m_pool == nullptr && m_options.threads > 1) {
+            m_owned_pool = std::make_unique<thread_pool>(m_options.threads);
+            m_pool = m_owned_pool.get();
+        }
+
+        // The lanes would report progress concurrently, which the callback is promised never to see
+        DiffOptions lane_options = m_options;
+        lane_options.pool = m_pool;
+        lane_options.progress = nullptr;
+        size_t lanes = m_pool != nullptr ? m_pool->size() + 1 : 1;
+
+        for (size_t i = 0; i < lanes; i++) {
+            m_diffs.push_back(std::make_unique<Diff>(lane_options));
+        }
+    }
+
+    MultiDiff(const MultiDiff&) = delete;
+    MultiDiff& operator= (const MultiDiff&) = delete;
+
+    // Hands the patches of every target to sink(target, patch), those of one target
+    // in order and from one thread. Different targets run concurrently, so sink may
+    // be called from several threads at once, for different targets.
+    template <class t_sink>
+    void diff(const sequence_view& base, const std::vector<sequence_view>& targets, t_sink&& sink) {
+        base_index index(base.begin(), base.size(), m_options);
+
+        auto job = [&index, &targets, &sink](Diff& diff, size_t i) {
+            diff.diff(index, targets[i], [&sink, i](const Patch& p) {
+                sink(i, p);
+            });
+        };
+
+        run(targets.size(), job);
+    }
+
+    std::vector<std::vector<Patch>> diff(const sequence_view& base, const std::vector<sequence_view>& targets) {
+        std::vector<std::vector<Patch>> patches(targets.size());
+
+        diff(base, targets, [&patches](size_t target, const Patch& p) {
+            patches[target].push_back(p);
+        });
+
+        return patches;
+    }
+
+    // Writes the encoded patch of every target to the stream at its position, the
+    // base hashed once for all of them. Each stream is written from one thread.
+    void encode(const sequence_view& base, const std::vector<sequence_view>& targets, const std::vector<std::ostream*>& outs,
+        const PatchCompression& compression = PatchCompression())
+    {
+        if (outs.size() != targets.size()) {
+            throw std::invalid_argument("every target needs a stream");
+        }
+
+        base_index index(base.begin(), base.size(), m_options);
+        uint64_t base_hash = xxhash64::hash(base.begin(), base.size());
+
+        auto job = [&](Diff& diff, size_t i) {
+            PatchHeader header;
+            header.source_size = base.size();
+            header.target_size = targets[i].size();
+            header.source_hash = base_hash;
+            header.target_hash = xxhash64::hash(targets[i].begin(), targets[i].size());
+
+            PatchEncoder encoder(*outs[i], header, compression, base.begin());
+            BasicEditCoalescer<char, PatchEncoder> script(base, targets[i], encoder);
+            diff.diff(index, targets[i], script);
+            script.finish();
+            encoder.finish();
+        };
+
+        run(targets.size(), job);
+    }
+
+    // Three-way diff of two sides that started out as base: both are diffed against
+    // the one index of base and their changes merged as diff3 does
+    std::vector<MergeHunk> merge(const sequence_view& base, const sequence_view& ours, const sequence_view& theirs) {
+        auto patches = diff(base, { ours, theirs });
+
+        return multi_detail::merge(ours, theirs, multi_detail::changes_of(normalize(base, ours, patches[0])),
+            multi_detail::changes_of(normalize(base, theirs, patches[1])));
+    }
+};
@@ -0,0 +1,528 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <atomic>
+#include <filesystem>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "diff.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "patch_format.hpp"
+
+class PatchApplyError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+struct ApplyOptions {
+    // Check the source and the rebuilt target against the hashes in the patch header
+    bool verify = true;
+};
+
+namespace patch_apply_detail {
+    // Targets take the steps of a patch as copy, insert and skip calls, in order
+
+    // Writes into a buffer that holds the whole target. The buffer may be the source
+    // itself, as long as writes never overtake the source cursor.
+    class buffer_writer {
+        const char* m_source;
+        uint64_t m_source_size;
+        uint64_t m_source_at;
+        char* m_out;
+        uint64_t m_out_size;
+        uint64_t m_out_at;
+
+        void check(uint64_t source_n, uint64_t out_n) const {
+            if (source_n > m_source_size - m_source_at || out_n > m_out_size - m_out_at) {
+                throw PatchApplyError("patch runs past the end of its source or target");
+            }
+        }
+
+      public:
+        buffer_writer(const char* source, uint64_t source_size, char* out, uint64_t out_size) :
+            m_source(source),
+            m_source_size(source_size),
+            m_source_at(0),
+            m_out(out),
+            m_out_size(out_size),
+            m_out_at(0)
+        { }
+
+        void copy(uint64_t n) {
+            check(n, n);
+
+            // In place a copy without preceding edits would move bytes onto themselves
+            if (n > 0 && m_out + m_out_at != m_source + m_source_at) {
+                std::memmove(m_out + m_out_at, m_source + m_source_at, n);
+            }
+
+            m_source_at += n;
+            m_out_at += n;
+        }
+
+        void insert(const char* data, uint64_t n) {
+            check(0, n);
+
+            if (n > 0) {
+                std::memcpy(m_out + m_out_at, data, n);
+            }
+
+            m_out_at += n;
+        }
+
+        void skip(uint64_t n) {
+            check(n, 0);
+            m_source_at += n;
+        }
+
+        void copy_from(uint64_t from, uint64_t n) {
+            check(0, n);
+
+            if (from > m_source_size || n > m_source_size - from) {
+                throw PatchApplyError("patch runs past the end of its source");
+            }
+
+            if (n > 0) {
+                std::memmove(m_out + m_out_at, m_source + from, n);
+            }
+
+            m_out_at += n;
+        }
+
+        void finish() const {
+            if (m_source_at != m_source_size || m_out_at != m_out_size) {
+                throw PatchApplyError("patch does not cover its source and target");
+            }
+        }
+    };
+
+    // Writes the target to a stream. Copies go straight from the source, so large runs
+    // turn into large writes, and the target hash is taken on the way out.
+    class stream_writer {
+        const char* m_source;
+        uint64_t m_source_size;
+        uint64_t m_source_at;
+        std::ostream& m_out;
+        uint64_t m_out_size;
+        uint64_t m_out_at;
+        xxhash64 m_hash;
+
+        void write(const char* data, uint64_t n) {
+            if (n > m_out_size - m_out_at) {
+                throw PatchApplyError("patch runs past the end of its target");
+            }
+
+            m_out.write(data, static_cast<std::streamsize>(n));
+            m_hash.update(data, n);
+            m_out_at += n;
+        }
+
+      public:
+        stream_writer(const char* source, uint64_t source_size, std::ostream& out, uint64_t out_size) :
+            m_source(source),
+            m_source_size(source_size),
+            m_source_at(0),
+            m_out(out),
+            m_out_size(out_size),
+            m_out_at(0),
+            m_hash()
+        { }
+
+        void copy(uint64_t n) {
+            skip(n);
+            write(m_source + m_source_at - n, n);
+        }
+
+        void insert(const char* data, uint64_t n) {
+            write(data, n);
+        }
+
+        void skip(uint64_t n) {
+            if (n > m_source_size - m_source_at) {
+                throw PatchApplyError("patch runs past the end of its source");
+            }
+
+            m_source_at += n;
+        }
+
+        void copy_from(uint64_t from, uint64_t n) {
+            if (from > m_source_size || n > m_source_size - from) {
+                throw PatchApplyError("patch runs past the end of its source");
+            }
+
+            write(m_source + from, n);
+        }
+
+        void finish() const {
+            if (m_source_at != m_source_size || m_out_at != m_out_size) {
+                throw PatchApplyError("patch does not cover its source and target");
+            }
+
+            if (!m_out) {
+                throw std::runtime_error("failed to write target");
+            }
+        }
+
+        uint64_t digest() const {
+            return m_hash.digest();
+        }
+    };
+
+    // Dry run that tells whether a patch can be applied over its own source. Copies keep
+    // the distance between both cursors, only inserts may close it. Moved blocks may
+    // read from anywhere, so patches with them always go through a second buffer.
+    struct in_place_check {
+        uint64_t source_at = 0;
+        uint64_t out_at = 0;
+        bool safe = true;
+
+        void copy(uint64_t n) {
+            source_at += n;
+            out_at += n;
+        }
+
+        void insert(const char*, uint64_t n) {
+            out_at += n;
+            safe = safe && out_at <= source_at;
+        }
+
+        void skip(uint64_t n) {
+            source_at += n;
+        }
+
+        void copy_from(uint64_t, uint64_t n) {
+            out_at += n;
+            safe = false;
+        }
+
+        void finish() const { }
+    };
+
+    template <class t_target>
+    void replay(PatchDecoder decoder, t_target& target) {
+        PatchRecord record;
+
+        while (decoder.next(record)) {
+            if (record.type == PatchRecordType::Copy) {
+                target.copy(record.length);
+            } else if (record.type == PatchRecordType::Insert) {
+                target.insert(record.data, record.length);
+            } else if (record.type == PatchRecordType::Move) {
+                target.copy_from(record.from, record.length);
+            } else if (record.type == PatchRecordType::Replace) {
+                target.skip(record.skipped);
+                target.insert(record.data, record.length);
+            } else {
+                target.skip(record.length);
+            }
+        }
+
+        target.finish();
+    }
+
+    // Patches come from a diff, so the unchanged runs between them are implied
+    template <class t_patch, class t_target>
+    void replay(const std::vector<t_patch>& patches, uint64_t source_size, t_target& target) {
+        uint64_t source_at = 0;
+        uint64_t target_at = 0;
+
+        for (const auto& p : patches) {
+            if (p.size() == 0) {
+                continue;
+            }
+
+            uint64_t at = p.GetOperation() == PatchOperation::Deletion ? source_at : target_at;
+
+            if (p.GetOperation() == PatchOperation::Undefined || p.offset() < at) {
+                throw std::invalid_argument("patches are not an ordered edit script");
+            }
+
+            target.copy(p.offset() - at);
+            source_at += p.offset() - at;
+            target_at += p.offset() - at;
+
+            if (p.GetOperation() == PatchOperation::Deletion) {
+                target.skip(p.size());
+                source_at += p.size();
+            } else if (p.GetOperation() == PatchOperation::Copy) {
+                target.copy_from(p.from(), p.size());
+                target_at += p.size();
+            } else {
+                target.insert(p.data(), p.size());
+                target_at += p.size();
+            }
+        }
+
+        if (source_at > source_size) {
+            throw PatchApplyError("patch runs past the end of its source");
+        }
+
+        target.copy(source_size - source_at);
+        target.finish();
+    }
+
+    // An edit script covers both inputs, so every edit has to start at the cursors
+    template <class t_target>
+    void replay(const std::vector<Edit>& edits, uint64_t source_size, t_target& target) {
+        uint64_t source_at = 0;
+        uint64_t target_at = 0;
+
+        for (const auto& e : edits) {
+            if (e.lhs.index_begin() != source_at || e.rhs.index_begin() != target_at) {
+                throw std::invalid_argument("edits are not a normalized edit script");
+            }
+
+            if (e.op == EditOperation::Keep) {
+                target.copy(e.lhs.size());
+            } else if (e.op == EditOperation::Move) {
+                target.copy_from(e.from, e.rhs.size());
+            } else {
+                target.skip(e.lhs.size());
+                target.insert(e.rhs.begin(), e.rhs.size());
+            }
+
+            source_at = e.lhs.index_end();
+            target_at = e.rhs.index_end();
+        }
+
+        if (source_at != source_size) {
+            throw PatchApplyError("edit script does not cover its source");
+        }
+
+        target.finish();
+    }
+
+    inline void verify_source(const PatchHeader& header, const char* source, size_t source_size, const ApplyOptions& options) {
+        if (header.source_size != source_size) {
+            throw PatchApplyError("source size does not match the patch");
+        }
+
+        if (options.verify && xxhash64::hash(source, source_size) != header.source_hash) {
+            throw PatchApplyError("source does not match the patch");
+        }
+    }
+
+    inline void verify_target(const PatchHeader& header, uint64_t hash, const ApplyOptions& options) {
+        if (options.verify && hash != header.target_hash) {
+            throw PatchApplyError("rebuilt target does not match the patch");
+        }
+    }
+}
+
+// Size the target of a diff will have, for sizing the buffers below
+template <class t_patch>
+uint64_t patched_size(uint64_t source_size, const std::vector<t_patch>& patches) {
+    uint64_t size = source_size;
+
+    for (const auto& p : patches) {
+        if (p.GetOperation() == PatchOperation::Deletion) {
+            size -= p.size();
+        } else if (p.GetOperation() == PatchOperation::Addition || p.GetOperation() == PatchOperation::Copy) {
+            size += p.size();
+        }
+    }
+
+    return size;
+}
+
+// Rebuilds the target of a diff into out, which holds exactly patched_size() bytes
+template <class t_patch>
+void apply_patches(const char* source, size_t source_size, const std::vector<t_patch>& patches, char* out, size_t out_size) {
+    patch_apply_detail::buffer_writer writer(source, source_size, out, out_size);
+    patch_apply_detail::replay(patches, source_size, writer);
+}
+
+template <class t_patch>
+std::string apply_patches(const char* source, size_t source_size, const std::vector<t_patch>& patches) {
+    std::string target(patched_size(source_size, patches), '\0');
+    apply_patches(source, source_size, patches, &target[0], target.size());
+
+    return target;
+}
+
+// Rebuilds the target of a normalized edit script made over source
+inline std::string apply_edits(const char* source, size_t source_size, const std::vector<Edit>& edits) {
+    std::string target(edits.empty() ? 0 : edits.back().rhs.index_end(), '\0');
+    patch_apply_detail::buffer_writer writer(source, source_size, &target[0], target.size());
+    patch_apply_detail::replay(edits, source_size, writer);
+
+    return target;
+}
+
+// Turns buffer from the source of a diff into its target. The patches are applied
+// over the buffer itself when no addition overtakes the source bytes still to be
+// read, otherwise through a second buffer.
+template <class t_patch>
+void apply_patches_in_place(std::string& buffer, const std::vector<t_patch>& patches) {
+    patch_apply_detail::in_place_check check;
+    patch_apply_detail::replay(patches, buffer.size(), check);
+
+    if (!check.safe) {
+        buffer = apply_patches(buffer.data(), buffer.size(), patches);
+        return;
+    }
+
+    size_t source_size = buffer.size();
+    size_t target_size = patched_size(source_size, patches);
+
+    if (target_size > source_size) {
+        buffer.resize(target_size);
+    }
+
+    apply_patches(buffer.data(), source_size, patches, &buffer[0], target_size);
+    buffer.resize(target_size);
+}
+
+namespace patch_apply_detail {
+    inline void apply(PatchDecoder decoder, const char* source, size_t source_size, char* out, size_t out_size, const ApplyOptions& options) {
+        verify_source(decoder.header(), source, source_size, options);
+        decoder.unpack(source, source_size);
+
+        if (decoder.header().target_size != out_size) {
+            throw PatchApplyError("target size does not match the patch");
+        }
+
+        buffer_writer writer(source, source_size, out, out_size);
+        replay(decoder, writer);
+        verify_target(decoder.header(), options.verify ? xxhash64::hash(out, out_size) : 0, options);
+    }
+}
+
+// Rebuilds the target of an encoded patch into out, which holds exactly the target
+// size from the patch header
+inline void apply_patch(const char* source, size_t source_size, const char* patch, size_t patch_size, char* out, size_t out_size, const ApplyOptions& options = ApplyOptions()) {
+    patch_apply_detail::apply(PatchDecoder(patch, patch_size), source, source_size, out, out_size, options);
+}
+
+inline std::string apply_patch(const char* source, size_t source_size, const char* patch, size_t patch_size, const ApplyOptions& options = ApplyOptions()) {
+    PatchDecoder decoder(patch, patch_size);
+    std::string target(decoder.header().target_size, '\0');
+    patch_apply_detail::apply(decoder, source, source_size, &target[0], target.size(), options);
+
+    return target;
+}
+
+// Writes the target to a stream as it is rebuilt, without holding it in memory
+inline void apply_patch(const char* source, size_t source_size, const char* patch, size_t patch_size, std::ostream& out, const ApplyOptions& options = ApplyOptions()) {
+    PatchDecoder decoder(patch, patch_size);
+    patch_apply_detail::verify_source(decoder.header(), source, source_size, options);
+    decoder.unpack(source, source_size);
+
+    patch_apply_detail::stream_writer writer(source, source_size, out, decoder.header().target_size);
+    patch_apply_detail::replay(decoder, writer);
+    out.flush();
+    patch_apply_detail::verify_target(decoder.header(), writer.digest(), options);
+}
+
+// Same as apply_patches_in_place, for an encoded patch
+inline void apply_patch_in_place(std::string& buffer, const char* patch, size_t patch_size, const ApplyOptions& options = ApplyOptions()) {
+    PatchDecoder decoder(patch, patch_size);
+    patch_apply_detail::verify_source(decoder.header(), buffer.data(), buffer.size(), options);
+    decoder.unpack(buffer.data(), buffer.size());
+
+    patch_apply_detail::in_place_check check;
+    patch_apply_detail::replay(decoder, check);
+
+    size_t source_size = buffer.size();
+    size_t target_size = decoder.header().target_size;
+
+    if (!check.safe) {
+        std::string target(target_size, '\0');
+        patch_apply_detail::buffer_writer writer(buffer.data(), source_size, &target[0], target_size);
+        patch_apply_detail::replay(decoder, writer);
+        buffer.swap(target);
+    } else {
+        if (target_size > source_size) {
+            buffer.resize(target_size);
+        }
+
+        patch_apply_detail::buffer_writer writer(buffer.data(), source_size, &buffer[0], target_size);
+        patch_apply_detail::replay(decoder, writer);
+        buffer.resize(target_size);
+    }
+
+    patch_apply_detail::verify_target(decoder.header(), options.verify ? xxhash64::hash(buffer.data(), buffer.size()) : 0, options);
+}
+
+namespace patch_apply_detail {
+    // Creates an empty file next to path that no other apply, thread or process has
+    // taken, named after a random token drawn once per process and a counter, and
+    // returns its name. The file is created exclusively, so an existing one is never
+    // reused or overwritten.
+    inline std::string create_temporary(const std::string& path) {
+        static const uint64_t token = [] {
+            std::random_device random;
+
+            return static_cast<uint64_t>(random()) << 32 ^ random();
+        }();
+        static std::atomic<uint64_t> count(0);
+
+        for (int attempt = 0; ; attempt++) {
+            std::string temporary = path + "." + std::to_string(token) + "-" + std::to_string(count++) + ".tmp";
+            std::FILE* file = std::fopen(temporary.c_str(), "wbx");
+
+            if (file != nullptr) {
+                std::fclose(file);
+                return temporary;
+            }
+
+            if (errno != EEXIST || attempt == 16) {
+                throw std::system_error(errno, std::generic_category(), temporary);
+            }
+        }
+    }
+}
+
+// Applies a patch file to a source file. The target is rebuilt in a mapped temporary
+// next to it and renamed over it once verified, so the target may be the source and
+// a failed apply leaves both untouched. Every apply takes a temporary of its own, so
+// concurrent applies to one target never write into each other's.
+inline void apply_patch_file(const std::string& source_path, const std::string& patch_path, const std::string& target_path, const ApplyOptions& options = ApplyOptions()) {
+    mapped_file source(source_path);
+    mapped_file patch(patch_path);
+    PatchDecoder decoder(patch.data(), patch.size());
+    std::string temporary = patch_apply_detail::create_temporary(target_path);
+
+    try {
+        {
+            mapped_output target(temporary, decoder.header().target_size);
+            patch_apply_detail::apply(decoder, source.data(), source.size(), target.data(), target.size(), options);
+            target.flush();
+        }
+
+        // The temporary was created with the default mode, a target that is replaced
+        // keeps its own, the execute bit included
+        std::error_code error;
+        auto status = std::filesystem::status(target_path, error);
+
+        if (!error && std::filesystem::exists(status)) {
+            std::filesystem::permissions(temporary, status.permissions());
+        }
+
+        // The source mapping has to go before the source can be replaced on Windows
+        source = mapped_file();
+#ifdef _WIN32
+        if (!MoveFileExA(temporary.c_str(), target_path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), target_path);
+        }
+#else
+        if (std::rename(temporary.c_str(), target_path.c_str()) != 0) {
+            throw std::system_error(errno, std::generic_category(), target_path);
+        }
+#endif
+    } catch (...) {
+        std::remove(temporary.c_str());
+        throw;
+    }
+}
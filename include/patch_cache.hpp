@@ -0,0 +1,384 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "diff.hpp"
+#include "edit_script.hpp"
+#include "hash.hpp"
+#include "patch_format.hpp"
+
+// Identifies an encoded patch by the content of both inputs and everything else
+// that shapes it: the kind of diff, the options that change its result and the
+// patch format version and compression level. Threads, deadlines, timeouts and progress leave
+// the patch as it is.
+struct PatchCacheKey {
+    uint64_t source_size = 0;
+    uint64_t target_size = 0;
+    uint64_t source_hash = 0;
+    uint64_t target_hash = 0;
+    uint64_t config = 0;
+
+    static PatchCacheKey describe(const PatchHeader& header, DiffKind kind, const DiffOptions& options, const PatchCompression& compression = PatchCompression()) {
+        std::string config;
+        patch_format_detail::put_u64(config, PatchHeader::version);
+        patch_format_detail::put_u64(config, static_cast<uint64_t>(kind));
+        patch_format_detail::put_u64(config, options.anchor_window);
+        patch_format_detail::put_u64(config, options.max_cost);
+        patch_format_detail::put_u64(config, options.block_size);
+        patch_format_detail::put_u64(config, static_cast<uint64_t>(compression.level));
+
+        PatchCacheKey key;
+        key.source_size = header.source_size;
+        key.target_size = header.target_size;
+        key.source_hash = header.source_hash;
+        key.target_hash = header.target_hash;
+        key.config = xxhash64::hash(config.data(), config.size());
+
+        return key;
+    }
+
+    // File name of the entry, the sizes are checked against the stored patch instead
+    std::string name() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string name;
+
+        for (uint64_t x : { source_hash, target_hash, config }) {
+            for (int shift = 60; shift >= 0; shift -= 4) {
+                name.push_back(digits[(x >> shift) & 0xF]);
+            }
+        }
+
+        return name;
+    }
+};
+
+struct PatchCacheOptions {
+    // Bytes of patches kept in memory, 0 keeps none there
+    size_t memory_limit = size_t(64) << 20;
+
+    // Directory that keeps patches across runs, empty keeps them in memory only
+    std::string directory = { };
+
+    // Bytes of patches kept in the directory
+    uint64_t disk_limit = uint64_t(1) << 30;
+};
+
+// Encoded patches by the inputs they were made from, so a pair diffed before is not
+// searched again. Entries live in memory and, with a directory, on disk, and each
+// tier evicts its least recently used entries past its size limit. The directory may
+// be shared between processes: entries are written to a temporary and renamed into
+// place, and a stored patch is checked against its key before it is used. The cache
+// is best effort, an entry that cannot be written is just not cached. Safe to share
+// between threads.
+class PatchCache {
+    using lru = std::list<std::pair<std::string, std::string>>;
+    using disk_lru = std::list<std::pair<std::string, uint64_t>>;
+
+    PatchCacheOptions m_options;
+    std::mutex m_mutex;
+
+    // Most recently used first, in memory by patch and on disk by size
+    lru m_memory;
+    std::unordered_map<std::string, lru::iterator> m_memory_index;
+    size_t m_memory_size;
+    disk_lru m_disk;
+    std::unordered_map<std::string, disk_lru::iterator> m_disk_index;
+    uint64_t m_disk_size;
+
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+
+    // Random per cache, the temporary files of other caches and processes sharing
+    // the directory never take the names of this one's
+    uint64_t m_token;
+    std::atomic<uint64_t> m_temporaries;
+
+    static uint64_t random_token() {
+        std::random_device random;
+
+        return static_cast<uint64_t>(random()) << 32 ^ random();
+    }
+
+    std::filesystem::path path_of(const std::string& name) const {
+        return std::filesystem::path(m_options.directory) / (name + ".bdp");
+    }
+
+    static bool matches(const std::string& patch, const PatchCacheKey& key) {
+        try {
+            PatchDecoder decoder(patch.data(), patch.size());
+            const PatchHeader& header = decoder.header();
+
+            return header.source_size == key.source_size && header.target_size == key.target_size &&
+                header.source_hash == key.source_hash && header.target_hash == key.target_hash;
+        } catch (const PatchFormatError&) {
+            return false;
+        }
+    }
+
+    static bool read(const std::filesystem::path& path, std::string& data) {
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        data = buffer.str();
+
+        return static_cast<bool>(in);
+    }
+
+    // Under m_mutex
+    void remember(const std::string& name, const std::string& patch) {
+        if (patch.size() > m_options.memory_limit || m_memory_index.count(name) != 0) {
+            return;
+        }
+
+        m_memory.emplace_front(name, patch);
+        m_memory_index[name] = m_memory.begin();
+        m_memory_size += patch.size();
+
+        while (m_memory_size > m_options.memory_limit) {
+            m_memory_size -= m_memory.back().second.size();
+            m_memory_index.erase(m_memory.back().first);
+            m_memory.pop_back();
+        }
+    }
+
+    // Under m_mutex
+    void forget_stored(disk_lru::iterator it) {
+        std::error_code error;
+        std::filesystem::remove(path_of(it->first), error);
+
+        m_disk_size -= it->second;
+        m_disk_index.erase(it->first);
+        m_disk.erase(it);
+    }
+
+    // Entries of earlier runs, most recently used first
+    void scan() {
+        std::error_code error;
+        std::filesystem::create_directories(m_options.directory, error);
+
+        std::vector<std::pair<std::filesystem::file_time_type, std::pair<std::string, uint64_t>>> found;
+
+        for (const auto& entry : std::filesystem::directory_iterator(m_options.directory, error)) {
+            std::error_code entry_error;
+
+            if (entry.path().extension() != ".bdp" || !entry.is_regular_file(entry_error)) {
+                continue;
+            }
+
+            auto time = entry.last_write_time(entry_error);
+            auto size = entry.file_size(entry_error);
+
+            if (!entry_error) {
+                found.push_back({ time, { entry.path().stem().string(), size } });
+            }
+        }
+
+        std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        });
+
+        for (const auto& f : found) {
+            m_disk.push_back(f.second);
+            m_disk_index[f.second.first] = std::prev(m_disk.end());
+            m_disk_size += f.second.second;
+        }
+
+        while (m_disk_size > m_options.disk_limit && !m_disk.empty()) {
+            forget_stored(std::prev(m_disk.end()));
+        }
+    }
+
+  public:
+    explicit PatchCache(const PatchCacheOptions& options = PatchCacheOptions()) :
+        m_options(options),
+        m_mutex(),
+        m_memory(),
+        m_memory_index(),
+        m_memory_size(0),
+        m_disk(),
+        m_disk_index(),
+        m_disk_size(0),
+        m_hits(0),
+        m_misses(0),
+        m_token(random_token()),
+        m_temporaries(0)
+    {
+        if (!m_options.directory.empty()) {
+            scan();
+        }
+    }
+
+    PatchCache(const PatchCache&) = delete;
+    PatchCache& operator= (const PatchCache&) = delete;
+
+    // Copies the patch stored for key to patch, false when there is none
+    bool find(const PatchCacheKey& key, std::string& patch) {
+        std::string name = key.name();
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        auto memory = m_memory_index.find(name);
+
+        if (memory != m_memory_index.end()) {
+            m_memory.splice(m_memory.begin(), m_memory, memory->second);
+            patch = memory->second->second;
+            m_hits++;
+
+            return true;
+        }
+
+        auto stored = m_disk_index.find(name);
+
+        if (stored == m_disk_index.end()) {
+            m_misses++;
+            return false;
+        }
+
+        m_disk.splice(m_disk.begin(), m_disk, stored->second);
+        lock.unlock();
+
+        // Read outside the lock, another thread may evict the entry meanwhile
+        std::filesystem::path path = path_of(name);
+        bool valid = read(path, patch) && matches(patch, key);
+        std::error_code error;
+
+        if (valid) {
+            std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        }
+
+        lock.lock();
+
+        if (valid) {
+            remember(name, patch);
+            m_hits++;
+
+            return true;
+        }
+
+        stored = m_disk_index.find(name);
+
+        if (stored != m_disk_index.end()) {
+            forget_stored(stored->second);
+        }
+
+        m_misses++;
+
+        return false;
+    }
+
+    void insert(const PatchCacheKey& key, const std::string& patch) {
+        std::string name = key.name();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            remember(name, patch);
+
+            if (m_options.directory.empty() || patch.size() > m_options.disk_limit || m_disk_index.count(name) != 0) {
+                return;
+            }
+        }
+
+        std::filesystem::path path = path_of(name);
+        std::filesystem::path temporary = path;
+        temporary += "." + std::to_string(m_token) + "-" + std::to_string(m_temporaries++) + ".tmp";
+
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out.write(patch.data(), static_cast<std::streamsize>(patch.size()));
+
+            if (!out.flush()) {
+                std::error_code error;
+                std::filesystem::remove(temporary, error);
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+
+        if (error) {
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_disk_index.count(name) != 0) {
+            return;
+        }
+
+        m_disk.emplace_front(name, patch.size());
+        m_disk_index[name] = m_disk.begin();
+        m_disk_size += patch.size();
+
+        while (m_disk_size > m_options.disk_limit) {
+            forget_stored(std::prev(m_disk.end()));
+        }
+    }
+
+    uint64_t hits() const noexcept {
+        return m_hits;
+    }
+
+    uint64_t misses() const noexcept {
+        return m_misses;
+    }
+};
+
+// Diffs lhs to rhs and writes the encoded patch to out. With a cache the patch is
+// looked up first and the diff only runs on a miss, its patch is stored then.
+// Returns true for a hit.
+template <class t_diff>
+bool encode_patch(t_diff& diff, DiffKind kind, const DiffOptions& options, const sequence_view& lhs, const sequence_view& rhs, std::ostream& out,
+    PatchCache* cache = nullptr, const PatchCompression& compression = PatchCompression()) {
+    PatchHeader header = PatchHeader::describe(lhs.begin(), lhs.size(), rhs.begin(), rhs.size());
+
+    auto encode = [&](std::ostream& to) {
+        PatchEncoder encoder(to, header, compression, lhs.begin());
+        BasicEditCoalescer<char, PatchEncoder> script(lhs, rhs, encoder);
+        diff.diff(lhs, rhs, script);
+        script.finish();
+        encoder.finish();
+    };
+
+    if (cache == nullptr) {
+        encode(out);
+        return false;
+    }
+
+    PatchCacheKey key = PatchCacheKey::describe(header, kind, options, compression);
+    std::string patch;
+    bool hit = cache->find(key, patch);
+
+    if (!hit) {
+        std::ostringstream buffer;
+        encode(buffer);
+        patch = buffer.str();
+        cache->insert(key, patch);
+    }
+
+    out.write(patch.data(), static_cast<std::streamsize>(patch.size()));
+    out.flush();
+
+    if (!out) {
+        throw std::runtime_error("failed to write patch");
+    }
+
+    return hit;
+}
@@ -0,0 +1,641 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <istream>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "diff.hpp"
+#include "edit_script.hpp"
+#include "hash.hpp"
+
+// Compressed records need libzstd, the CMake option defines BIN_DIFF_ZSTD=1 and links
+// it when it is found. Without it compressed patches can be neither made nor applied.
+#ifndef BIN_DIFF_ZSTD
+#define BIN_DIFF_ZSTD 0
+#endif
+
+#if BIN_DIFF_ZSTD
+#include <zstd.h>
+#endif
+
+// Binary patch layout, integers are little endian:
+//
+//   header   "BDPF", u8 version, u8 flags, u16 reserved,
+//            u64 source size, u64 target size, u64 source XXH64, u64 target XXH64
+//   records  u8 tag and varint (LEB128) length
+//            Copy n       copies n bytes from the source cursor
+//            Insert n     followed by the n bytes to insert
+//            Delete n     skips n source bytes
+//            Move n o     followed by varint o, copies n bytes from source offset o
+//            Replace n s  followed by varint s and the n bytes to insert in place
+//                         of the next s source bytes
+//            End
+//   trailer  u64 XXH64 of everything before it
+//
+// The source cursor only moves forward and Move leaves it where it is, so a patch
+// applies in one linear pass with random reads only for the moved blocks. Replace
+// came with version 2, version 1 patches decode unchanged.
+//
+// With flag bit 0 (zstd_records), which came with version 3, the records are a
+// single zstd frame instead, compressed with the whole source as raw prefix content.
+// Inserted bytes that repeat parts of the source then cost a back reference, and the
+// frame carries its decompressed size. Unpacking the records needs the source.
+// Decoders reject Replace records and flags in patches older than their version.
+
+class PatchFormatError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class PatchRecordType : uint8_t {
+    End = 0,
+    Copy = 1,
+    Insert = 2,
+    Delete = 3,
+    Move = 4,
+    Replace = 5
+};
+
+struct PatchRecord {
+    PatchRecordType type;
+    uint64_t length;
+
+    // Literal bytes of an Insert, points into the decoded buffer
+    const char* data;
+
+    // Source offset of a Move
+    uint64_t from;
+
+    // Source bytes a Replace skips
+    uint64_t skipped;
+};
+
+struct PatchHeader {
+    static constexpr char magic[4] = { 'B', 'D', 'P', 'F' };
+    static constexpr uint8_t version = 3;
+    static constexpr uint8_t min_version = 1;
+
+    // Patches with raw records keep this version, so builds without compression read them
+    static constexpr uint8_t raw_version = 2;
+    static constexpr size_t encoded_size = 40;
+
+    // Flag bits
+    static constexpr uint8_t zstd_records = 1;
+
+    uint8_t flags = 0;
+    uint64_t source_size = 0;
+    uint64_t target_size = 0;
+    uint64_t source_hash = 0;
+    uint64_t target_hash = 0;
+
+    static PatchHeader describe(const char* source, size_t source_size, const char* target, size_t target_size) {
+        PatchHeader header;
+        header.source_size = source_size;
+        header.target_size = target_size;
+        header.source_hash = xxhash64::hash(source, source_size);
+        header.target_hash = xxhash64::hash(target, target_size);
+
+        return header;
+    }
+};
+
+struct PatchCompression {
+    static constexpr bool available = BIN_DIFF_ZSTD != 0;
+
+    // zstd level of the records, 0 stores them raw. Negative levels trade size for speed.
+    int level = 0;
+
+    // zstd workers for large patches, 0 and 1 compress on the calling thread
+    unsigned threads = 0;
+
+    bool enabled() const noexcept {
+        return level != 0;
+    }
+};
+
+namespace patch_format_detail {
+    inline void put_u64(std::string& out, uint64_t x) {
+        for (int i = 0; i < 8; i++) {
+            out.push_back(static_cast<char>(x >> (8 * i)));
+        }
+    }
+
+    inline uint64_t get_u64(const char* p) {
+        uint64_t x = 0;
+
+        for (int i = 0; i < 8; i++) {
+            x |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+        }
+
+        return x;
+    }
+
+    inline void put_varint(std::string& out, uint64_t x) {
+        while (x >= 0x80) {
+            out.push_back(static_cast<char>(x | 0x80));
+            x >>= 7;
+        }
+
+        out.push_back(static_cast<char>(x));
+    }
+
+    // Sizes and hashes of a header, the part that follows magic, version and flags
+    inline void put_header_fields(std::string& out, const PatchHeader& header) {
+        put_u64(out, header.source_size);
+        put_u64(out, header.target_size);
+        put_u64(out, header.source_hash);
+        put_u64(out, header.target_hash);
+    }
+
+    inline uint64_t get_varint(const char* data, size_t size, size_t& at) {
+        uint64_t x = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (at >= size) {
+                throw PatchFormatError("truncated patch");
+            }
+
+            auto byte = static_cast<unsigned char>(data[at++]);
+            x |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return x;
+            }
+        }
+
+        throw PatchFormatError("malformed varint in patch");
+    }
+
+    // Tag and up to three ten byte varints
+    constexpr uint64_t max_record_overhead = 1 + 3 * 10;
+
+    // Most bytes the records of a patch between these sizes take. Encoders never write
+    // empty records, so all but End take at least one byte of the source or the
+    // target, and only target bytes are written out. Saturates at the u64 range.
+    inline uint64_t max_records_size(const PatchHeader& header) {
+        constexpr uint64_t limit = UINT64_MAX / (2 * (max_record_overhead + 1));
+
+        if (header.source_size > limit || header.target_size > limit) {
+            return UINT64_MAX;
+        }
+
+        return header.target_size + (header.source_size + header.target_size + 1) * max_record_overhead;
+    }
+
+#if BIN_DIFF_ZSTD
+    // Records below this size are not worth handing to zstd workers
+    constexpr size_t zstd_parallel_size = size_t(4) << 20;
+
+    template <class t_error>
+    size_t zstd_check(size_t result) {
+        if (ZSTD_isError(result)) {
+            throw t_error(std::string("zstd: ") + ZSTD_getErrorName(result));
+        }
+
+        return result;
+    }
+
+    // Smallest window that reaches from the end of the target back to the start of
+    // the source, as far as zstd allows
+    inline int zstd_window_log(uint64_t size) {
+        ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+        int log = bounds.lowerBound;
+
+        while (log < bounds.upperBound && (uint64_t(1) << log) < size) {
+            log++;
+        }
+
+        return log;
+    }
+
+    // Appends the records compressed as one frame to out. Long distance matching
+    // finds the source blocks that inserts repeat however far back they are.
+    inline void zstd_compress(const char* records, size_t size, const char* source, size_t source_size, uint64_t target_size, const PatchCompression& compression, std::string& out) {
+        std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+
+        if (!ctx) {
+            throw std::bad_alloc();
+        }
+
+        zstd_check<std::runtime_error>(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_compressionLevel, compression.level));
+        zstd_check<std::runtime_error>(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_windowLog, zstd_window_log(source_size + target_size)));
+        zstd_check<std::runtime_error>(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_enableLongDistanceMatching, 1));
+
+        if (compression.threads > 1 && size >= zstd_parallel_size) {
+            // A libzstd built without threads refuses, the frame is compressed here then
+            ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_nbWorkers, static_cast<int>(compression.threads));
+        }
+
+        if (source_size > 0) {
+            zstd_check<std::runtime_error>(ZSTD_CCtx_refPrefix(ctx.get(), source, source_size));
+        }
+
+        size_t at = out.size();
+        out.resize(at + ZSTD_compressBound(size));
+        out.resize(at + zstd_check<std::runtime_error>(ZSTD_compress2(ctx.get(), &out[at], out.size() - at, records, size)));
+    }
+
+    // The frame states its own decompressed size, which is checked against max_size
+    // before anything is allocated, so a crafted frame cannot ask for more
+    inline std::string zstd_decompress(const char* data, size_t size, const char* source, size_t source_size, uint64_t max_size) {
+        unsigned long long records_size = ZSTD_getFrameContentSize(data, size);
+
+        if (records_size == ZSTD_CONTENTSIZE_ERROR || records_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+            throw PatchFormatError("malformed compressed records");
+        }
+
+        if (records_size > max_size || records_size > SIZE_MAX) {
+            throw PatchFormatError("compressed records larger than the patch allows");
+        }
+
+        std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+
+        if (!ctx) {
+            throw std::bad_alloc();
+        }
+
+        zstd_check<PatchFormatError>(ZSTD_DCtx_setParameter(ctx.get(), ZSTD_d_windowLogMax, ZSTD_dParam_getBounds(ZSTD_d_windowLogMax).upperBound));
+
+        if (source_size > 0) {
+            zstd_check<PatchFormatError>(ZSTD_DCtx_refPrefix(ctx.get(), source, source_size));
+        }
+
+        std::string records(static_cast<size_t>(records_size), '\0');
+
+        if (zstd_check<PatchFormatError>(ZSTD_decompressDCtx(ctx.get(), &records[0], records.size(), data, size)) != records.size()) {
+            throw PatchFormatError("truncated compressed records");
+        }
+
+        return records;
+    }
+#endif
+}
+
+// Sink that turns the ordered patches of a diff into the binary format. Gaps between
+// patches become Copy records. It takes a normalized edit script as well, which
+// maps onto the records one to one. Output is buffered and written in large chunks.
+// Compressed records are held until finish and go out as one frame.
+class PatchEncoder {
+    static constexpr size_t flush_size = 1 << 20;
+
+    std::ostream& m_out;
+    PatchHeader m_header;
+    PatchCompression m_compression;
+    const char* m_source;
+    std::string m_buffer;
+    xxhash64 m_hash;
+    bool m_header_written;
+    uint64_t m_source_at;
+    uint64_t m_target_at;
+
+    void flush() {
+        m_header_written = true;
+        m_hash.update(m_buffer.data(), m_buffer.size());
+        m_out.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+        m_buffer.clear();
+    }
+
+    void put_record(PatchRecordType type, uint64_t length) {
+        m_buffer.push_back(static_cast<char>(type));
+        patch_format_detail::put_varint(m_buffer, length);
+    }
+
+    void check_move(uint64_t from, uint64_t size) const {
+        if (from > m_header.source_size || size > m_header.source_size - from) {
+            throw std::invalid_argument("copy from outside the source");
+        }
+    }
+
+    void maybe_flush() {
+        if (!m_compression.enabled() && m_buffer.size() >= flush_size) {
+            flush();
+        }
+    }
+
+    void copy_to(uint64_t source_at, uint64_t target_at) {
+        if (source_at < m_source_at || target_at < m_target_at || source_at - m_source_at != target_at - m_target_at) {
+            throw std::invalid_argument("patches are not an ordered edit script");
+        }
+
+        if (source_at > m_source_at) {
+            put_record(PatchRecordType::Copy, source_at - m_source_at);
+        }
+
+        m_source_at = source_at;
+        m_target_at = target_at;
+    }
+
+  public:
+    PatchEncoder(std::ostream& out, const PatchHeader& header) : PatchEncoder(out, header, PatchCompression(), nullptr) { }
+
+    // Compressed records take the source the patch applies to as their dictionary.
+    // Without it, as for streams, they are compressed on their own.
+    PatchEncoder(std::ostream& out, const PatchHeader& header, const PatchCompression& compression, const char* source) :
+        m_out(out),
+        m_header(header),
+        m_compression(compression),
+        m_source(source),
+        m_buffer(),
+        m_hash(),
+        m_header_written(false),
+        m_source_at(0),
+        m_target_at(0)
+    {
+        if (m_compression.enabled()) {
+            if (!PatchCompression::available) {
+                throw std::invalid_argument("zstd compression needs a build with BIN_DIFF_ZSTD");
+            }
+
+            m_header.flags |= PatchHeader::zstd_records;
+        }
+
+        m_buffer.append(PatchHeader::magic, sizeof(PatchHeader::magic));
+        m_buffer.push_back(static_cast<char>(m_compression.enabled() ? PatchHeader::version : PatchHeader::raw_version));
+        m_buffer.push_back(static_cast<char>(m_header.flags));
+        m_buffer.append(2, '\0');
+        patch_format_detail::put_header_fields(m_buffer, header);
+    }
+
+    PatchEncoder(const PatchEncoder&) = delete;
+    PatchEncoder& operator= (const PatchEncoder&) = delete;
+
+    // Takes Patches and OwnedPatches, deletions carry source offsets, additions and copies target offsets
+    template <class t_patch>
+    void operator() (const t_patch& p) {
+        if (p.size() == 0) {
+            return;
+        }
+
+        if (p.GetOperation() == PatchOperation::Deletion) {
+            copy_to(p.offset(), m_target_at + (p.offset() - m_source_at));
+            put_record(PatchRecordType::Delete, p.size());
+            m_source_at += p.size();
+        } else if (p.GetOperation() == PatchOperation::Addition) {
+            copy_to(m_source_at + (p.offset() - m_target_at), p.offset());
+            put_record(PatchRecordType::Insert, p.size());
+            m_buffer.append(p.data(), p.size());
+            m_target_at += p.size();
+        } else if (p.GetOperation() == PatchOperation::Copy) {
+            check_move(p.from(), p.size());
+            copy_to(m_source_at + (p.offset() - m_target_at), p.offset());
+            put_record(PatchRecordType::Move, p.size());
+            patch_format_detail::put_varint(m_buffer, p.from());
+            m_target_at += p.size();
+        } else {
+            throw std::invalid_argument("cannot encode an undefined patch");
+        }
+
+        maybe_flush();
+    }
+
+    void operator() (const Edit& e) {
+        copy_to(e.lhs.index_begin(), e.rhs.index_begin());
+
+        if (e.op == EditOperation::Keep) {
+            copy_to(e.lhs.index_end(), e.rhs.index_end());
+        } else if (e.op == EditOperation::Delete && e.lhs.size() > 0) {
+            put_record(PatchRecordType::Delete, e.lhs.size());
+            m_source_at += e.lhs.size();
+        } else if (e.op == EditOperation::Insert && e.rhs.size() > 0) {
+            put_record(PatchRecordType::Insert, e.rhs.size());
+            m_buffer.append(e.rhs.begin(), e.rhs.size());
+            m_target_at += e.rhs.size();
+        } else if (e.op == EditOperation::Replace) {
+            put_record(PatchRecordType::Replace, e.rhs.size());
+            patch_format_detail::put_varint(m_buffer, e.lhs.size());
+            m_buffer.append(e.rhs.begin(), e.rhs.size());
+            m_source_at += e.lhs.size();
+            m_target_at += e.rhs.size();
+        } else if (e.op == EditOperation::Move && e.rhs.size() > 0) {
+            check_move(e.from, e.rhs.size());
+            put_record(PatchRecordType::Move, e.rhs.size());
+            patch_format_detail::put_varint(m_buffer, e.from);
+            m_target_at += e.rhs.size();
+        }
+
+        maybe_flush();
+    }
+
+    // Closes a patch whose inputs were only known once they were diffed, as those of
+    // streams. The encoder is made with sizes no smaller than the real ones, header
+    // has the real sizes and hashes. Returns false when the patch has outgrown its
+    // buffer and the header is out already, rewrite_header then puts the real one in.
+    bool finish(const PatchHeader& header) {
+        m_header.source_size = header.source_size;
+        m_header.target_size = header.target_size;
+        m_header.source_hash = header.source_hash;
+        m_header.target_hash = header.target_hash;
+
+        bool written = m_header_written;
+
+        if (!written) {
+            std::string fields;
+            patch_format_detail::put_header_fields(fields, m_header);
+            m_buffer.replace(8, fields.size(), fields);
+        }
+
+        finish();
+
+        return !written;
+    }
+
+    // Copies the rest of the source and closes the patch
+    void finish() {
+        copy_to(m_header.source_size, m_header.target_size);
+        put_record(PatchRecordType::End, 0);
+
+#if BIN_DIFF_ZSTD
+        if (m_compression.enabled()) {
+            std::string packed(m_buffer, 0, PatchHeader::encoded_size);
+            patch_format_detail::zstd_compress(m_buffer.data() + PatchHeader::encoded_size, m_buffer.size() - PatchHeader::encoded_size,
+                m_source, m_source != nullptr ? static_cast<size_t>(m_header.source_size) : 0, m_header.target_size, m_compression, packed);
+            m_buffer.swap(packed);
+        }
+#endif
+
+        flush();
+
+        std::string trailer;
+        patch_format_detail::put_u64(trailer, m_hash.digest());
+        m_out.write(trailer.data(), static_cast<std::streamsize>(trailer.size()));
+        m_out.flush();
+
+        if (!m_out) {
+            throw std::runtime_error("failed to write patch");
+        }
+    }
+};
+
+// Puts the sizes and hashes of header into an encoded patch in a seekable stream and
+// recomputes its trailer. That reads the patch back once, which is far less than
+// reading the inputs once more when they are streamed.
+inline void rewrite_header(std::iostream& patch, const PatchHeader& header) {
+    std::string fields;
+    patch_format_detail::put_header_fields(fields, header);
+
+    patch.seekg(0, std::ios::end);
+    auto size = static_cast<uint64_t>(patch.tellg());
+
+    if (!patch || size < PatchHeader::encoded_size + 8) {
+        throw std::runtime_error("failed to rewrite patch header");
+    }
+
+    patch.seekp(8);
+    patch.write(fields.data(), static_cast<std::streamsize>(fields.size()));
+    patch.flush();
+    patch.seekg(0);
+
+    std::string buffer(1 << 20, '\0');
+    xxhash64 hash;
+
+    for (uint64_t at = 0; at < size - 8 && patch; ) {
+        auto n = static_cast<std::streamsize>(std::min<uint64_t>(buffer.size(), size - 8 - at));
+        patch.read(&buffer[0], n);
+        hash.update(buffer.data(), static_cast<size_t>(patch.gcount()));
+        at += static_cast<uint64_t>(patch.gcount());
+    }
+
+    std::string trailer;
+    patch_format_detail::put_u64(trailer, hash.digest());
+    patch.seekp(static_cast<std::streamoff>(size - 8));
+    patch.write(trailer.data(), static_cast<std::streamsize>(trailer.size()));
+    patch.flush();
+
+    if (!patch) {
+        throw std::runtime_error("failed to rewrite patch header");
+    }
+}
+
+// Walks the records of an encoded patch held in memory. The checksum is verified up
+// front, so nothing is applied from a damaged patch. Compressed records are unpacked
+// against the source first, copies of the decoder share them.
+class PatchDecoder {
+    const char* m_data;
+    size_t m_size;
+    size_t m_at;
+    uint8_t m_version;
+    PatchHeader m_header;
+    std::shared_ptr<const std::string> m_records;
+
+  public:
+    PatchDecoder(const char* data, size_t size) :
+        m_data(data),
+        m_size(size),
+        m_at(PatchHeader::encoded_size),
+        m_version(0),
+        m_header(),
+        m_records()
+    {
+        using namespace patch_format_detail;
+
+        if (size < PatchHeader::encoded_size + 8 || std::memcmp(data, PatchHeader::magic, sizeof(PatchHeader::magic)) != 0) {
+            throw PatchFormatError("not a bin-diff patch");
+        }
+
+        m_version = static_cast<uint8_t>(data[4]);
+
+        if (m_version < PatchHeader::min_version || m_version > PatchHeader::version) {
+            throw PatchFormatError("unsupported patch version");
+        }
+
+        if (xxhash64::hash(data, size - 8) != get_u64(data + size - 8)) {
+            throw PatchFormatError("patch checksum mismatch");
+        }
+
+        m_header.flags = static_cast<uint8_t>(data[5]);
+        m_header.source_size = get_u64(data + 8);
+        m_header.target_size = get_u64(data + 16);
+        m_header.source_hash = get_u64(data + 24);
+        m_header.target_hash = get_u64(data + 32);
+
+        if ((m_header.flags & ~PatchHeader::zstd_records) != 0 || (compressed() && m_version < 3)) {
+            throw PatchFormatError("unsupported patch flags");
+        }
+
+        // The trailer is not part of the records
+        m_size -= 8;
+    }
+
+    PatchDecoder(const PatchDecoder&) = default;
+    PatchDecoder& operator= (const PatchDecoder&) = default;
+
+    const PatchHeader& header() const {
+        return m_header;
+    }
+
+    uint8_t version() const noexcept {
+        return m_version;
+    }
+
+    bool compressed() const noexcept {
+        return (m_header.flags & PatchHeader::zstd_records) != 0;
+    }
+
+    // Decompresses the records with the source of the patch, which has to be the one
+    // it was made from. Does nothing for raw records, so appliers always call it.
+    void unpack(const char* source, size_t source_size) {
+        if (!compressed() || m_records) {
+            return;
+        }
+
+#if BIN_DIFF_ZSTD
+        m_records = std::make_shared<const std::string>(patch_format_detail::zstd_decompress(m_data + m_at, m_size - m_at, source, source_size,
+            patch_format_detail::max_records_size(m_header)));
+        m_data = m_records->data();
+        m_size = m_records->size();
+        m_at = 0;
+#else
+        throw PatchFormatError("patch is compressed with zstd, which needs a build with BIN_DIFF_ZSTD");
+#endif
+    }
+
+    // Reads the next record, returns false once End is reached
+    bool next(PatchRecord& record) {
+        using namespace patch_format_detail;
+
+        if (compressed() && !m_records) {
+            throw PatchFormatError("compressed patch records were not unpacked");
+        }
+
+        if (m_at >= m_size) {
+            throw PatchFormatError("truncated patch");
+        }
+
+        auto type = static_cast<PatchRecordType>(m_data[m_at++]);
+
+        if (type == PatchRecordType::End) {
+            record = { type, 0, nullptr, 0, 0 };
+            return false;
+        } else if (type != PatchRecordType::Copy && type != PatchRecordType::Insert && type != PatchRecordType::Delete &&
+            type != PatchRecordType::Move && (type != PatchRecordType::Replace || m_version < 2)) {
+            throw PatchFormatError("unknown patch record");
+        }
+
+        record = { type, get_varint(m_data, m_size, m_at), nullptr, 0, 0 };
+
+        if (type == PatchRecordType::Move) {
+            record.from = get_varint(m_data, m_size, m_at);
+        } else if (type == PatchRecordType::Replace) {
+            record.skipped = get_varint(m_data, m_size, m_at);
+        }
+
+        if (type == PatchRecordType::Insert || type == PatchRecordType::Replace) {
+            if (record.length > m_size - m_at) {
+                throw PatchFormatError("truncated patch");
+            }
+
+            record.data = m_data + m_at;
+            m_at += record.length;
+        }
+
+        return true;
+    }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <type_traits>
+
+// Polynomial hash over a fixed window that slides one element at a time in O(1).
+// Arithmetic is mod 2^64 with an odd base, elements are offset by one so runs of
+// zeros still hash differently by length. Elements are bytes or other integers.
+class rolling_hash {
+    static constexpr uint64_t base = 0x100000001b3ull;
+
+    size_t m_window;
+    uint64_t m_out_factor;
+    uint64_t m_hash;
+
+    template <class t_elem>
+    static uint64_t value_of(t_elem c) {
+        return static_cast<uint64_t>(static_cast<std::make_unsigned_t<t_elem>>(c)) + 1;
+    }
+
+  public:
+    explicit rolling_hash(size_t window) : m_window(window), m_out_factor(1), m_hash(0) {
+        for (size_t i = 1; i < window; i++) {
+            m_out_factor *= base;
+        }
+    }
+
+    template <class t_elem>
+    static uint64_t hash(const t_elem* p, size_t n) {
+        uint64_t h = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            h = h * base + value_of(p[i]);
+        }
+
+        return h;
+    }
+
+    size_t window() const {
+        return m_window;
+    }
+
+    uint64_t value() const {
+        return m_hash;
+    }
+
+    // Starts over on the window beginning at p
+    template <class t_elem>
+    uint64_t reset(const t_elem* p) {
+        m_hash = hash(p, m_window);
+        return m_hash;
+    }
+
+    // Slides the window one element: out leaves at the front, in enters at the back
+    template <class t_elem>
+    uint64_t roll(t_elem out, t_elem in) {
+        m_hash = (m_hash - value_of(out) * m_out_factor) * base + value_of(in);
+        return m_hash;
+    }
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "anchors.hpp"
+#include "diff.hpp"
+#include "hash.hpp"
+
+struct StreamOptions {
+    // Bytes buffered per input to start with
+    size_t window_size = 1 << 22;
+
+    // Windows grow up to this many bytes while looking for an anchor to resync on.
+    // Peak memory is bounded by a small multiple of it, the buffers plus the
+    // scratch of the Myers search over one window.
+    size_t max_window_size = 1 << 26;
+
+    // Length of the rolling-hash anchors the windows are resynced on
+    size_t anchor_window = 64;
+
+    // Windows without a single anchor are related at most in short runs, above
+    // this size they are emitted as a deletion and an addition without a search
+    size_t exact_limit = 1 << 16;
+
+    // Cost limit of the searches between anchors, see DiffOptions::max_cost. Windows
+    // are large, so unrelated gaps between anchors must not be searched exhaustively.
+    size_t max_cost = 1 << 6;
+
+    DiffOptions diff;
+
+    StreamOptions() : diff() { }
+};
+
+// Diffs two streams window by window. Each round fills both windows, cuts them at
+// the last anchor that matches across them, diffs the parts before the cut and
+// carries the rest over into the next round. Without such an anchor the windows
+// grow, and once they are at their maximum they are replaced wholesale. Patches
+// are handed to the sink as OwnedPatches with absolute offsets as soon as their
+// window is done.
+class StreamDiff {
+    StreamOptions m_options;
+    Diff m_diff;
+    std::vector<char> m_lhs;
+    std::vector<char> m_rhs;
+    size_t m_lhs_size;
+    size_t m_rhs_size;
+
+    // Summed over the windows of the last diff
+    DiffStats m_stats;
+
+    // Sizes and XXH64 of the inputs of the last diff, taken as the windows read them
+    uint64_t m_lhs_read;
+    uint64_t m_rhs_read;
+    xxhash64 m_lhs_hash;
+    xxhash64 m_rhs_hash;
+
+    static bool fill(std::istream& in, std::vector<char>& buffer, size_t& size, uint64_t& read, xxhash64& hash) {
+        while (size < buffer.size() && in) {
+            in.read(buffer.data() + size, static_cast<std::streamsize>(buffer.size() - size));
+            hash.update(buffer.data() + size, static_cast<size_t>(in.gcount()));
+            read += static_cast<uint64_t>(in.gcount());
+            size += static_cast<size_t>(in.gcount());
+        }
+
+        return !in;
+    }
+
+    static void consume(std::vector<char>& buffer, size_t& size, size_t n) {
+        std::copy(buffer.begin() + n, buffer.begin() + size, buffer.begin());
+        size -= n;
+    }
+
+    template <class t_sink>
+    void emit_diff(size_t lhs_cut, size_t rhs_cut, size_t lhs_base, size_t rhs_base, t_sink& sink) {
+        m_diff.diff(sequence_view(m_lhs.data(), 0, lhs_cut), sequence_view(m_rhs.data(), 0, rhs_cut), [&](const Patch& p) {
+            size_t base = p.source() == PatchSource::Lhs ? lhs_base : rhs_base;
+            sink(OwnedPatch(p.GetOperation(), base + p.offset(), p.str(), lhs_base + p.from()));
+        });
+
+        m_stats.merge(m_diff.stats());
+    }
+
+    template <class t_sink>
+    void emit_replace(size_t lhs_begin, size_t lhs_end, size_t rhs_begin, size_t rhs_end, size_t lhs_base, size_t rhs_base, t_sink& sink) {
+        if (lhs_end > lhs_begin) {
+            sink(OwnedPatch(PatchOperation::Deletion, lhs_base + lhs_begin, std::string(m_lhs.data() + lhs_begin, lhs_end - lhs_begin)));
+        }
+
+        if (rhs_end > rhs_begin) {
+            sink(OwnedPatch(PatchOperation::Addition, rhs_base + rhs_begin, std::string(m_rhs.data() + rhs_begin, rhs_end - rhs_begin)));
+        }
+    }
+
+    static DiffOptions window_options(const StreamOptions& options) {
+        DiffOptions diff = options.diff;
+        diff.anchor_window = options.anchor_window;
+        diff.max_cost = options.max_cost;
+
+        return diff;
+    }
+
+  public:
+    explicit StreamDiff(const StreamOptions& options = StreamOptions()) :
+        m_options(options),
+        m_diff(window_options(options)),
+        m_lhs(options.window_size),
+        m_rhs(options.window_size),
+        m_lhs_size(0),
+        m_rhs_size(0),
+        m_stats(),
+        m_lhs_read(0),
+        m_rhs_read(0),
+        m_lhs_hash(),
+        m_rhs_hash()
+    { }
+
+    template <class t_sink>
+    void diff(std::istream& lhs, std::istream& rhs, t_sink&& sink) {
+        size_t lhs_base = 0;
+        size_t rhs_base = 0;
+
+        m_lhs.resize(m_options.window_size);
+        m_rhs.resize(m_options.window_size);
+        m_lhs_size = 0;
+        m_rhs_size = 0;
+        m_stats = DiffStats();
+        m_lhs_read = 0;
+        m_rhs_read = 0;
+        m_lhs_hash = xxhash64();
+        m_rhs_hash = xxhash64();
+
+        while (true) {
+            bool lhs_done = fill(lhs, m_lhs, m_lhs_size, m_lhs_read, m_lhs_hash);
+            bool rhs_done = fill(rhs, m_rhs, m_rhs_size, m_rhs_read, m_rhs_hash);
+
+            if (m_lhs_size == 0 && m_rhs_size == 0) {
+                break;
+            }
+
+            auto anchors = find_anchors(m_lhs.data(), m_lhs_size, m_rhs.data(), m_rhs_size, m_options.anchor_window);
+
+            size_t lhs_cut = m_lhs_size;
+            size_t rhs_cut = m_rhs_size;
+
+            if (lhs_done && rhs_done) {
+                if (anchors.empty() && lhs_cut + rhs_cut > m_options.exact_limit) {
+                    emit_replace(0, lhs_cut, 0, rhs_cut, lhs_base, rhs_base, sink);
+                } else {
+                    emit_diff(lhs_cut, rhs_cut, lhs_base, rhs_base, sink);
+                }
+            } else if (!anchors.empty() && anchors.back().lhs + anchors.back().rhs > 0) {
+                // Cut at the last anchor, it stays in the windows and resyncs the next round
+                lhs_cut = anchors.back().lhs;
+                rhs_cut = anchors.back().rhs;
+
+                emit_diff(lhs_cut, rhs_cut, lhs_base, rhs_base, sink);
+            } else if (m_lhs.size() < m_options.max_window_size) {
+                m_lhs.resize(std::min(2 * m_lhs.size(), m_options.max_window_size));
+                m_rhs.resize(std::min(2 * m_rhs.size(), m_options.max_window_size));
+                continue;
+            } else {
+                // Only an anchor carried over from the last round can match, past it the
+                // windows have nothing in common that is worth a search
+                size_t common = anchors.empty() ? 0 : anchors.front().size;
+                emit_replace(common, lhs_cut, common, rhs_cut, lhs_base, rhs_base, sink);
+            }
+
+            consume(m_lhs, m_lhs_size, lhs_cut);
+            consume(m_rhs, m_rhs_size, rhs_cut);
+            lhs_base += lhs_cut;
+            rhs_base += rhs_cut;
+        }
+    }
+
+    // Counters of the last diff, all zero unless built with BIN_DIFF_STATS
+    const DiffStats& stats() const {
+        return m_stats;
+    }
+
+    // Sizes and XXH64 of both inputs of the last diff, for the header of its patch
+    uint64_t lhs_size() const noexcept {
+        return m_lhs_read;
+    }
+
+    uint64_t rhs_size() const noexcept {
+        return m_rhs_read;
+    }
+
+    uint64_t lhs_hash() const {
+        return m_lhs_hash.digest();
+    }
+
+    uint64_t rhs_hash() const {
+        return m_rhs_hash.digest();
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <thread>
+
+#include "thread_pool.hpp"
+
+// Helpers a shared search takes when positive, whatever the number of cores and of
+// idle workers, so tests exercise the shared rounds on small machines. 0 takes one
+// per spare core, as far as there are idle workers for them.
+#ifndef BIN_DIFF_SWEEP_HELPERS
+#define BIN_DIFF_SWEEP_HELPERS 0
+#endif
+
+// Threads that share the rounds of one middle snake search. A round is split into
+// chunks that the members claim one at a time, and it ends once every chunk is done,
+// so there is a barrier after each round. Helpers are pool tasks that stay for the
+// whole search and spin between rounds. The thread running the rounds takes part in
+// each and claims whatever chunks are left, so a round never waits on a helper that
+// has not started, a busy pool only costs the parallelism.
+class sweep_team {
+    // Round in the upper half, chunks left to claim in the lower half, so a claim
+    // can never take a chunk of a round that is already over
+    std::atomic<uint64_t> m_claim;
+    std::atomic<size_t> m_done;
+    std::atomic<bool> m_stopping;
+    uint64_t m_round;
+
+    // The work of the current round, set before the round is published
+    void (*m_call)(void*, size_t);
+    void* m_work;
+
+    task_group m_group;
+
+    // Runs one chunk of the current round, false when none is left to claim
+    bool claim_one() {
+        uint64_t claim = m_claim.load(std::memory_order_acquire);
+
+        while ((claim & 0xFFFFFFFFu) != 0) {
+            if (m_claim.compare_exchange_weak(claim, claim - 1, std::memory_order_acquire, std::memory_order_acquire)) {
+                m_call(m_work, static_cast<size_t>((claim & 0xFFFFFFFFu) - 1));
+                m_done.fetch_add(1, std::memory_order_release);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void serve() {
+        while (!m_stopping.load(std::memory_order_acquire)) {
+            if (!claim_one()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+  public:
+    sweep_team(thread_pool& pool, size_t helpers) :
+        m_claim(0),
+        m_done(0),
+        m_stopping(false),
+        m_round(0),
+        m_call(nullptr),
+        m_work(nullptr),
+        m_group(pool)
+    {
+        for (size_t i = 0; i < helpers; i++) {
+            m_group.run([this] { serve(); });
+        }
+    }
+
+    sweep_team(const sweep_team&) = delete;
+    sweep_team& operator= (const sweep_team&) = delete;
+
+    // Helpers that never started are run, and leave, as the group joins
+    ~sweep_team() {
+        m_stopping.store(true, std::memory_order_release);
+    }
+
+    // Calls work(i) for every i in [0, chunks), in no particular order and from any
+    // member, and returns once all of them are done
+    template <class t_work>
+    void run(size_t chunks, t_work& work) {
+        m_call = [](void* w, size_t i) {
+            (*static_cast<t_work*>(w))(i);
+        };
+        m_work = &work;
+        m_done.store(0, std::memory_order_relaxed);
+
+        m_round++;
+        m_claim.store((m_round << 32) | chunks, std::memory_order_release);
+
+        while (claim_one()) { }
+
+        while (m_done.load(std::memory_order_acquire) < chunks) {
+            std::this_thread::yield();
+        }
+    }
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Work-stealing pool: every worker pushes and pops its own deque at the back,
+// idle workers steal from the front of the others. Tasks submitted from outside
+// the pool land in an extra queue that every worker steals from. A task may carry
+// an owner, so a thread waiting on a group only runs the tasks of that group and
+// never one a caller on another thread forked and is still waiting for.
+class thread_pool {
+    struct task {
+        const void* owner;
+        std::function<void()> run;
+    };
+
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+
+        task_queue() : mutex(), tasks() { }
+    };
+
+    std::vector<std::unique_ptr<task_queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_queued;
+    std::atomic<size_t> m_idle;
+    std::atomic<bool> m_stopping;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+
+    inline static thread_local const thread_pool* t_pool = nullptr;
+    inline static thread_local size_t t_index = 0;
+
+    static bool takes(const task& t, const void* owner) {
+        return owner == nullptr || t.owner == owner;
+    }
+
+    bool pop(size_t index, const void* owner, std::function<void()>& run) {
+        auto& queue = *m_queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        for (auto it = queue.tasks.rbegin(); it != queue.tasks.rend(); ++it) {
+            if (takes(*it, owner)) {
+                run = std::move(it->run);
+                queue.tasks.erase(std::next(it).base());
+                m_queued--;
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool steal(size_t index, const void* owner, std::function<void()>& run) {
+        for (size_t i = 1; i <= m_queues.size(); i++) {
+            auto& queue = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            for (auto it = queue.tasks.begin(); it != queue.tasks.end(); ++it) {
+                if (takes(*it, owner)) {
+                    run = std::move(it->run);
+                    queue.tasks.erase(it);
+                    m_queued--;
+
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void work(size_t index) {
+        t_pool = this;
+        t_index = index;
+
+        while (!m_stopping) {
+            if (!run_one()) {
+                std::unique_lock<std::mutex> lock(m_sleep_mutex);
+                m_idle++;
+                m_wake.wait(lock, [this] { return m_queued > 0 || m_stopping; });
+                m_idle--;
+            }
+        }
+    }
+
+  public:
+    // Most workers a pool starts however many it is asked for, more than a few per
+    // core only add switches
+    static size_t max_threads() {
+        return 4 * std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+
+    explicit thread_pool(size_t threads = std::thread::hardware_concurrency()) :
+        m_queues(),
+        m_threads(),
+        m_queued(0),
+        m_idle(0),
+        m_stopping(false),
+        m_sleep_mutex(),
+        m_wake()
+    {
+        threads = std::clamp<size_t>(threads, 1, max_threads());
+
+        for (size_t i = 0; i < threads + 1; i++) {
+            m_queues.push_back(std::make_unique<task_queue>());
+        }
+
+        for (size_t i = 0; i < threads; i++) {
+            m_threads.emplace_back(&thread_pool::work, this, i);
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator= (const thread_pool&) = delete;
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(m_sleep_mutex);
+            m_stopping = true;
+        }
+
+        m_wake.notify_all();
+
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    size_t size() const {
+        return m_threads.size();
+    }
+
+    // Workers asleep for want of tasks. It is only a snapshot, they wake as soon as
+    // anything is submitted.
+    size_t idle() const noexcept {
+        return m_idle.load(std::memory_order_relaxed);
+    }
+
+    // Index of the calling worker, or size() for threads outside the pool. Every
+    // outside thread shares that index, so state kept per index must belong to one
+    // caller, and that caller must only help with its own tasks while it waits.
+    size_t worker_index() const {
+        return t_pool == this ? t_index : size();
+    }
+
+    void submit(std::function<void()> run, const void* owner = nullptr) {
+        {
+            auto& queue = *m_queues[worker_index()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back({ owner, std::move(run) });
+            m_queued++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        }
+
+        m_wake.notify_one();
+    }
+
+    // Runs one queued task of owner on the calling thread, or any task when owner is
+    // null, returns false when there was none
+    bool run_one(const void* owner = nullptr) {
+        std::function<void()> run;
+        size_t index = worker_index();
+
+        if (pop(index, owner, run) || steal(index, owner, run)) {
+            run();
+            return true;
+        }
+
+        return false;
+    }
+};
+
+// Fork-join scope over a pool. wait() runs queued tasks of the group while it waits,
+// so tasks may fork and wait themselves without tying up workers. Other tasks are
+// left alone: one of them may need state the waiting thread is still in the middle
+// of, such as the scratch of a diff another thread outside the pool runs.
+class task_group {
+    thread_pool& m_pool;
+    std::atomic<size_t> m_pending;
+    std::mutex m_error_mutex;
+    std::exception_ptr m_error;
+
+    void join() {
+        while (m_pending.load(std::memory_order_acquire) > 0) {
+            if (!m_pool.run_one(this)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+  public:
+    explicit task_group(thread_pool& pool) : m_pool(pool), m_pending(0), m_error_mutex(), m_error() { }
+
+    task_group(const task_group&) = delete;
+    task_group& operator= (const task_group&) = delete;
+
+    ~task_group() {
+        join();
+    }
+
+    template <class t_func>
+    void run(t_func&& func) {
+        m_pending++;
+
+        m_pool.submit([this, func = std::forward<t_func>(func)]() mutable {
+            try {
+                func();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_error_mutex);
+
+                if (!m_error) {
+                    m_error = std::current_exception();
+                }
+            }
+
+            m_pending.fetch_sub(1, std::memory_order_release);
+        }, this);
+    }
+
+    void wait() {
+        join();
+
+        if (m_error) {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+};
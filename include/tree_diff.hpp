@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "batch_diff.hpp"
+#include "diff.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+enum class TreeChange {
+    Unchanged,
+    Modified,
+    Added,
+    Removed,
+    Renamed
+};
+
+// One file of either tree, paths relative to the roots and with '/' separators.
+// Added files have no lhs, removed files no rhs.
+struct TreeEntry {
+    TreeChange change = TreeChange::Unchanged;
+    std::string lhs = { };
+    std::string rhs = { };
+};
+
+namespace tree_diff_detail {
+    struct file {
+        std::string path;
+        uint64_t size;
+        uint64_t hash;
+        bool hashed;
+        bool renamed;
+    };
+
+    // Regular files below root, sorted on path
+    inline std::vector<file> list_files(const std::filesystem::path& root) {
+        std::vector<file> files;
+
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(root)) {
+            if (entry.is_regular_file()) {
+                files.push_back({ entry.path().lexically_relative(root).generic_string(), entry.file_size(), 0, false, false });
+            }
+        }
+
+        std::sort(files.begin(), files.end(), [](const file& a, const file& b) {
+            return a.path < b.path;
+        });
+
+        return files;
+    }
+
+    inline uint64_t hash_file(const std::filesystem::path& path) {
+        mapped_file f(path.string());
+        return xxhash64::hash(f.data(), f.size());
+    }
+
+    inline bool same_bytes(const std::filesystem::path& lhs, const std::filesystem::path& rhs) {
+        mapped_file a(lhs.string());
+        mapped_file b(rhs.string());
+
+        return a.size() == b.size() && (a.size() == 0 || std::memcmp(a.data(), b.data(), a.size()) == 0);
+    }
+}
+
+// Diff of two directory trees. Files are matched on path, then the remaining ones
+// on content, so a file that moved is a rename and not a removal plus an addition.
+// Files are only read where they can decide something: a pair whose sizes differ
+// changed without reading either file, one of equal size is compared byte for byte.
+// Hashes only pick the rename candidates, and as XXH64 is no proof of identity those
+// are compared byte for byte too. Only the modified pairs go to the diff.
+class TreeDiff {
+    DiffOptions m_options;
+    BatchOptions m_batch;
+    std::unique_ptr<thread_pool> m_owned_pool;
+    thread_pool* m_pool;
+
+    using file = tree_diff_detail::file;
+
+    template <class t_task>
+    void for_each(size_t count, t_task&& task) {
+        if (m_pool == nullptr) {
+            for (size_t i = 0; i < count; i++) {
+                task(i);
+            }
+
+            return;
+        }
+
+        task_group group(*m_pool);
+
+        for (size_t i = 0; i < count; i++) {
+            group.run([&task, i] {
+                task(i);
+            });
+        }
+
+        group.wait();
+    }
+
+    void list(const std::filesystem::path& lhs_root, const std::filesystem::path& rhs_root, std::vector<file>& lhs, std::vector<file>& rhs) {
+        for_each(2, [&](size_t i) {
+            if (i == 0) {
+                lhs = tree_diff_detail::list_files(lhs_root);
+            } else {
+                rhs = tree_diff_detail::list_files(rhs_root);
+            }
+        });
+    }
+
+    // Both sides in one pass, so small trees on one side still fill the pool
+    void hash(const std::filesystem::path& lhs_root, const std::vector<file*>& lhs, const std::filesystem::path& rhs_root, const std::vector<file*>& rhs) {
+        for_each(lhs.size() + rhs.size(), [&](size_t i) {
+            bool left = i < lhs.size();
+            file* f = left ? lhs[i] : rhs[i - lhs.size()];
+
+            f->hash = tree_diff_detail::hash_file((left ? lhs_root : rhs_root) / f->path);
+            f->hashed = true;
+        });
+    }
+
+    // Compares the files of the pairs in one pass, true where they hold the same bytes
+    std::vector<char> same(const std::filesystem::path& lhs_root, const std::filesystem::path& rhs_root, const std::vector<std::pair<file*, file*>>& pairs) {
+        std::vector<char> equal(pairs.size(), 0);
+
+        for_each(pairs.size(), [&](size_t i) {
+            equal[i] = tree_diff_detail::same_bytes(lhs_root / pairs[i].first->path, rhs_root / pairs[i].second->path);
+        });
+
+        return equal;
+    }
+
+  public:
+    TreeDiff() : TreeDiff(DiffOptions()) { }
+
+    explicit TreeDiff(const DiffOptions& options, const BatchOptions& batch = BatchOptions()) :
+        m_options(options),
+        m_batch(batch),
+        m_owned_pool(),
+        m_pool(options.pool)
+    {
+        if (m_pool == nullptr && m_options.threads > 1) {
+            m_owned_pool = std::make_unique<thread_pool>(m_options.threads);
+            m_pool = m_owned_pool.get();
+        }
+
+        m_options.pool = m_pool;
+    }
+
+    TreeDiff(const TreeDiff&) = delete;
+    TreeDiff& operator= (const TreeDiff&) = delete;
+
+    // Classifies every file of both trees without diffing any. Entries are sorted on
+    // the rhs path, removed files follow on their lhs path.
+    std::vector<TreeEntry> compare(const std::string& lhs_root, const std::string& rhs_root) {
+        std::vector<file> lhs, rhs;
+        list(lhs_root, rhs_root, lhs, rhs);
+
+        // Same path: equal sizes need a look at the bytes, the rest is left over for renames
+        std::vector<std::pair<file*, file*>> same_path;
+        std::vector<file*> lhs_only, rhs_only;
+
+        for (size_t i = 0, j = 0; i < lhs.size() || j < rhs.size(); ) {
+            if (j == rhs.size() || (i < lhs.size() && lhs[i].path < rhs[j].path)) {
+                lhs_only.push_back(&lhs[i++]);
+            } else if (i == lhs.size() || rhs[j].path < lhs[i].path) {
+                rhs_only.push_back(&rhs[j++]);
+            } else {
+                same_path.emplace_back(&lhs[i++], &rhs[j++]);
+            }
+        }
+
+        // Pairs to compare, the same paths first and then the renames, and the rhs
+        // files no rename was found for
+        std::vector<std::pair<file*, file*>> matched;
+        std::vector<const file*> added;
+
+        for (const auto& p : same_path) {
+            if (p.first->size == p.second->size) {
+                matched.push_back(p);
+            }
+        }
+
+        size_t on_path = matched.size();
+
+        // A rename needs a file of the same size on the other side, the others stay unread
+        std::set<uint64_t> lhs_sizes, rhs_sizes;
+
+        for (const file* f : lhs_only) {
+            lhs_sizes.insert(f->size);
+        }
+
+        for (const file* f : rhs_only) {
+            rhs_sizes.insert(f->size);
+        }
+
+        std::vector<file*> lhs_hash, rhs_hash;
+
+        for (file* f : lhs_only) {
+            if (rhs_sizes.count(f->size) != 0) {
+                lhs_hash.push_back(f);
+            }
+        }
+
+        for (file* f : rhs_only) {
+            if (lhs_sizes.count(f->size) != 0) {
+                rhs_hash.push_back(f);
+            }
+        }
+
+        hash(lhs_root, lhs_hash, rhs_root, rhs_hash);
+
+        std::multimap<std::pair<uint64_t, uint64_t>, file*> removed;
+
+        for (file* f : lhs_only) {
+            if (f->hashed) {
+                removed.emplace(std::make_pair(f->size, f->hash), f);
+            }
+        }
+
+        for (file* f : rhs_only) {
+            auto it = f->hashed ? removed.find({ f->size, f->hash }) : removed.end();
+
+            if (it != removed.end()) {
+                matched.emplace_back(it->second, f);
+                removed.erase(it);
+            } else {
+                added.push_back(f);
+            }
+        }
+
+        std::vector<char> equal = same(lhs_root, rhs_root, matched);
+        std::vector<TreeEntry> entries;
+
+        for (size_t i = 0, m = 0; i < same_path.size(); i++) {
+            bool unchanged = m < on_path && matched[m].first == same_path[i].first && equal[m++];
+            entries.push_back({ unchanged ? TreeChange::Unchanged : TreeChange::Modified, same_path[i].first->path, same_path[i].second->path });
+        }
+
+        // A rename whose bytes differ is an addition, its lhs file is left removed
+        for (size_t m = on_path; m < matched.size(); m++) {
+            if (equal[m]) {
+                entries.push_back({ TreeChange::Renamed, matched[m].first->path, matched[m].second->path });
+                matched[m].first->renamed = true;
+            } else {
+                added.push_back(matched[m].second);
+            }
+        }
+
+        for (const file* f : added) {
+            entries.push_back({ TreeChange::Added, { }, f->path });
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const TreeEntry& a, const TreeEntry& b) {
+            return a.rhs < b.rhs;
+        });
+
+        for (const file* f : lhs_only) {
+            if (!f->renamed) {
+                entries.push_back({ TreeChange::Removed, f->path, { } });
+            }
+        }
+
+        return entries;
+    }
+
+    // Compares the trees and writes a patch for every modified file to the same
+    // relative path below patch_root, with ".bdp" appended. report gets every entry
+    // and, for modified files, the BatchResult of its patch, nullptr otherwise. It is
+    // called from one thread at a time.
+    template <class t_report>
+    void diff(const std::string& lhs_root, const std::string& rhs_root, const std::string& patch_root, t_report&& report) {
+        std::vector<TreeEntry> entries = compare(lhs_root, rhs_root);
+        std::vector<BatchJob> jobs;
+        std::vector<const TreeEntry*> modified;
+
+        for (const auto& e : entries) {
+            if (e.change != TreeChange::Modified) {
+                report(e, static_cast<const BatchResult*>(nullptr));
+                continue;
+            }
+
+            std::filesystem::path patch = std::filesystem::path(patch_root) / (e.rhs + ".bdp");
+            std::filesystem::create_directories(patch.parent_path());
+
+            jobs.push_back({
+                (std::filesystem::path(lhs_root) / e.lhs).string(),
+                (std::filesystem::path(rhs_root) / e.rhs).string(),
+                patch.string()
+            });
+            modified.push_back(&e);
+        }
+
+        BatchDiff batch(m_options, m_batch);
+
+        batch.run(jobs, [&](const BatchResult& r) {
+            report(*modified[r.index], &r);
+        });
+    }
+};
+
+inline const char* to_string(TreeChange change) {
+    switch (change) {
+        case TreeChange::Unchanged: return "unchanged";
+        case TreeChange::Modified: return "modified";
+        case TreeChange::Added: return "added";
+        case TreeChange::Removed: return "removed";
+        case TreeChange::Renamed: return "renamed";
+    }
+
+    return "unknown";
+}
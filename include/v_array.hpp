@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+// Furthest reaching x per diagonal k, for one direction of a middle snake search.
+// The diagonals live in a ring of a power of two slots and k is reduced with a
+// mask, so negative diagonals need neither a modulo nor signed wraparound: k is
+// converted to size_t, which is defined modulo 2^64. Only the diagonals live in
+// one round, and their neighbours, have to fit in the ring.
+template <class t_int>
+class v_array {
+    t_int* m_values;
+    size_t m_mask;
+
+  public:
+    v_array(t_int* values, size_t capacity) : m_values(values), m_mask(capacity - 1) { }
+
+    v_array(const v_array&) = default;
+    v_array& operator= (const v_array&) = default;
+
+    t_int& operator[] (t_int k) noexcept {
+        return m_values[static_cast<size_t>(k) & m_mask];
+    }
+
+    t_int operator[] (t_int k) const noexcept {
+        return m_values[static_cast<size_t>(k) & m_mask];
+    }
+
+    // Slots for a window of diagonals
+    static size_t capacity_for(size_t diagonals) {
+        size_t capacity = 16;
+
+        while (capacity < diagonals) {
+            capacity *= 2;
+        }
+
+        return capacity;
+    }
+};
+
+// The forward and backward arrays of a search, back to back in one buffer that is
+// reused across searches. The rings start small and double as D grows, so a search
+// only clears and touches memory in proportion to the D it reaches, not to the
+// size of its inputs. They stop growing at the size that holds every window the
+// search can have.
+template <class t_int>
+class v_arrays {
+    static constexpr size_t initial_capacity = 64;
+
+    std::vector<t_int>& m_buffer;
+    std::vector<t_int>& m_spill;
+    size_t m_limit;
+    size_t m_capacity;
+    size_t m_grown;
+    v_array<t_int> m_forward;
+    v_array<t_int> m_backward;
+
+    void allocate(size_t capacity) {
+        if (m_buffer.size() < 2 * capacity) {
+            m_grown += (2 * capacity - m_buffer.size()) * sizeof(t_int);
+            m_buffer.resize(2 * capacity);
+        }
+
+        std::fill(m_buffer.begin(), m_buffer.begin() + static_cast<ptrdiff_t>(2 * capacity), t_int(0));
+
+        m_capacity = capacity;
+        m_forward = v_array<t_int>(m_buffer.data(), capacity);
+        m_backward = v_array<t_int>(m_buffer.data() + capacity, capacity);
+    }
+
+  public:
+    // diagonals is the widest window the search can have
+    v_arrays(std::vector<t_int>& buffer, std::vector<t_int>& spill, size_t diagonals) :
+        m_buffer(buffer),
+        m_spill(spill),
+        m_limit(v_array<t_int>::capacity_for(diagonals)),
+        m_capacity(0),
+        m_grown(0),
+        m_forward(nullptr, 1),
+        m_backward(nullptr, 1)
+    {
+        allocate(std::min(initial_capacity, m_limit));
+    }
+
+    v_arrays(const v_arrays&) = delete;
+    v_arrays& operator= (const v_arrays&) = delete;
+
+    v_array<t_int>& forward() noexcept {
+        return m_forward;
+    }
+
+    v_array<t_int>& backward() noexcept {
+        return m_backward;
+    }
+
+    const v_array<t_int>& forward() const noexcept {
+        return m_forward;
+    }
+
+    const v_array<t_int>& backward() const noexcept {
+        return m_backward;
+    }
+
+    // Bytes the shared buffer grew by
+    size_t grown() const noexcept {
+        return m_grown;
+    }
+
+    // Makes room for round D. Round D reads the diagonals round D - 1 wrote, which
+    // lie in [-(D - 1), D - 1], and writes [-D, D].
+    void prepare(t_int D) {
+        if (2 * static_cast<size_t>(D) + 4 <= m_capacity || m_capacity == m_limit) {
+            return;
+        }
+
+        m_spill.clear();
+
+        for (t_int k = -(D - 1); k <= D - 1; k++) {
+            m_spill.push_back(m_forward[k]);
+            m_spill.push_back(m_backward[k]);
+        }
+
+        size_t capacity = m_capacity;
+
+        while (capacity < 2 * static_cast<size_t>(D) + 4 && capacity < m_limit) {
+            capacity *= 2;
+        }
+
+        allocate(capacity);
+
+        size_t i = 0;
+
+        for (t_int k = -(D - 1); k <= D - 1; k++) {
+            m_forward[k] = m_spill[i++];
+            m_backward[k] = m_spill[i++];
+        }
+    }
+};
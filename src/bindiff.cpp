@@ -0,0 +1,101 @@
+#include "bindiff.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#include "diff.hpp"
+#include "line_diff.hpp"
+#include "mapped_file.hpp"
+#include "patch_apply.hpp"
+#include "patch_cache.hpp"
+#include "patch_format.hpp"
+#include "thread_pool.hpp"
+
+struct DiffEngine::state {
+    // Shared by both diffs
+    std::unique_ptr<thread_pool> pool;
+
+    DiffOptions options;
+    PatchCompression compression;
+    std::unique_ptr<PatchCache> cache;
+    Diff bytes;
+    LineDiff lines;
+
+    static DiffOptions with_pool(DiffOptions options, std::unique_ptr<thread_pool>& pool) {
+        if (options.pool == nullptr && options.threads > 1) {
+            pool = std::make_unique<thread_pool>(options.threads);
+            options.pool = pool.get();
+        }
+
+        return options;
+    }
+
+    state(const DiffOptions& diff, const PatchOptions& patch) :
+        pool(),
+        options(with_pool(diff, pool)),
+        compression(),
+        cache(),
+        bytes(options),
+        lines(options)
+    {
+        compression.level = patch.compression;
+        compression.threads = static_cast<unsigned>(std::min(options.threads, thread_pool::max_threads()));
+
+        if (!patch.cache_directory.empty()) {
+            PatchCacheOptions cache_options;
+            cache_options.directory = patch.cache_directory;
+            cache_options.disk_limit = patch.cache_size;
+            cache = std::make_unique<PatchCache>(cache_options);
+        }
+    }
+
+    template <class t_diff>
+    DiffResult encode(t_diff& diff, DiffKind kind, const char* lhs, size_t lhs_size, const char* rhs, size_t rhs_size) {
+        DiffResult result;
+        std::ostringstream out;
+
+        result.cached = encode_patch(diff, kind, options, sequence_view(lhs, 0, lhs_size), sequence_view(rhs, 0, rhs_size), out, cache.get(), compression);
+        result.patch = out.str();
+
+        if (!result.cached) {
+            result.stats = diff.stats();
+        }
+
+        return result;
+    }
+};
+
+DiffEngine::DiffEngine(const DiffOptions& options, const PatchOptions& patch) : m_state(std::make_unique<state>(options, patch)) { }
+
+DiffEngine::~DiffEngine() = default;
+
+DiffEngine::DiffEngine(DiffEngine&&) noexcept = default;
+
+DiffEngine& DiffEngine::operator= (DiffEngine&&) noexcept = default;
+
+DiffResult DiffEngine::diff(const char* lhs, size_t lhs_size, const char* rhs, size_t rhs_size, DiffKind kind) {
+    if (kind == DiffKind::Lines) {
+        return m_state->encode(m_state->lines, kind, lhs, lhs_size, rhs, rhs_size);
+    }
+
+    return m_state->encode(m_state->bytes, kind, lhs, lhs_size, rhs, rhs_size);
+}
+
+DiffResult DiffEngine::diff_files(const std::string& lhs, const std::string& rhs, DiffKind kind) {
+    mapped_file lhs_file(lhs);
+    mapped_file rhs_file(rhs);
+
+    return diff(lhs_file.data(), lhs_file.size(), rhs_file.data(), rhs_file.size(), kind);
+}
+
+std::string DiffEngine::apply(const char* source, size_t source_size, const char* patch, size_t patch_size) {
+    return apply_patch(source, source_size, patch, patch_size);
+}
+
+void DiffEngine::apply_files(const std::string& source, const std::string& patch, const std::string& target) {
+    apply_patch_file(source, patch, target);
+}
+
+bool DiffEngine::compression_available() noexcept {
+    return PatchCompression::available;
+}
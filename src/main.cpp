@@ -1,22 +1,805 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "batch_diff.hpp"
 #include "diff.hpp"
+#include "diff_trace.hpp"
+#include "hash.hpp"
+#include "line_diff.hpp"
+#include "multi_diff.hpp"
+#include "patch_apply.hpp"
+#include "patch_cache.hpp"
+#include "patch_format.hpp"
+#include "stream_diff.hpp"
+#include "thread_pool.hpp"
+#include "tree_diff.hpp"
+
+struct Arguments {
+    DiffOptions options;
+    StreamOptions stream_options;
+    bool stream = false;
+    bool lines = false;
+    bool text = false;
+    bool stats = false;
+    bool progress = false;
+    bool targets = false;
+    bool merge = false;
+    bool profile = false;
+    std::string output;
+    std::string trace;
+    std::string batch;
+    PatchCacheOptions cache;
+    PatchCompression compression;
+    std::vector<std::string> files;
+
+    Arguments() : options(), stream_options(), output(), trace(), batch(), cache(), compression(), files() { }
+};
+
+static int usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [-j threads] [-a anchor-window] [-c max-cost] [-b block-size] [-t timeout] [-z level] [--stream [-w window-size] | --lines [--progress] | --progress] [--text] [--stats] [--cache dir [--cache-size MiB]] [-o patch] <old-file> <new-file>" << std::endl;
+    std::cerr << "       " << argv0 << " [-j threads] [-a anchor-window] [-c max-cost] [-b block-size] [-t timeout] [-z level] [--stats] [--cache dir [--cache-size MiB]] [-o patch-dir] <old-dir> <new-dir>" << std::endl;
+    std::cerr << "       " << argv0 << " [-j threads] [-a anchor-window] [-c max-cost] [-b block-size] [-t timeout] [-z level] [--stats] [--cache dir [--cache-size MiB]] --batch <manifest>" << std::endl;
+    std::cerr << "       " << argv0 << " [-j threads] [-a anchor-window] [-c max-cost] [-b block-size] [-t timeout] [-z level] [-o patch-dir] --targets <old-file> <new-file>..." << std::endl;
+    std::cerr << "       " << argv0 << " [-j threads] [-a anchor-window] [-c max-cost] [-b block-size] [-t timeout] --merge <base-file> <our-file> <their-file>" << std::endl;
+    std::cerr << "       " << argv0 << " profile [-j threads] [-a anchor-window] [-c max-cost] [-b block-size] [-z level] [--trace trace.json] [-o patch-dir] <corpus-dir>" << std::endl;
+    std::cerr << "       " << argv0 << " apply <old-file> <patch> <new-file>" << std::endl;
+    std::cerr << "--stream reads both inputs once, but twice when the patch goes to stdout or another output that cannot seek, which needs the header first" << std::endl;
+    return 2;
+}
+
+// Parses all of text as a number in [min, max], unsigned types take no sign
+template <class T>
+static bool parse_number(const char* text, T min, T max, T& value) {
+    const char* end = text + std::strlen(text);
+    T parsed{};
+    auto result = std::from_chars(text, end, parsed);
+
+    // Written so a NaN fails the range check
+    if (result.ec != std::errc() || result.ptr != end || !(parsed >= min && parsed <= max)) {
+        return false;
+    }
+
+    value = parsed;
+
+    return true;
+}
+
+static std::ifstream open_input(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+
+    if (!in) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    return in;
+}
+
+static std::ostream& open_output(const Arguments& args, std::ofstream& file) {
+    if (args.output.empty() || args.output == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        return std::cout;
+    }
+
+    file.open(args.output, std::ios::binary | std::ios::trunc);
+
+    if (!file) {
+        throw std::system_error(errno, std::generic_category(), args.output);
+    }
+
+    return file;
+}
+
+// Hashes a whole stream in one pass, for the header of a streamed diff that goes to
+// an output it cannot be rewritten in
+static void describe_stream(const std::string& path, uint64_t& size, uint64_t& hash) {
+    std::ifstream in = open_input(path);
+    std::vector<char> buffer(1 << 20);
+    xxhash64 h;
+
+    size = 0;
+
+    while (in) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        h.update(buffer.data(), static_cast<size_t>(in.gcount()));
+        size += static_cast<uint64_t>(in.gcount());
+    }
+
+    hash = h.digest();
+}
+
+// One line of JSON on stderr, stdout may carry the patch
+static void write_stats(const DiffStats& stats) {
+    stats.write_json(std::cerr);
+    std::cerr << std::endl;
+}
+
+// The inputs are read once, hashed as the windows read them, and the header of a
+// patch file is rewritten once they are done. Only a patch on stdout or another
+// output that cannot seek needs its header up front, the inputs are read once
+// more for it then.
+static void run_stream(Arguments& args) {
+    args.stream_options.diff = args.options;
+
+    // Every window is a diff of its own, the timeout is for the whole stream
+    if (args.options.timeout > std::chrono::steady_clock::duration::zero()) {
+        args.stream_options.diff.deadline = std::chrono::steady_clock::now() + args.options.timeout;
+        args.stream_options.diff.timeout = std::chrono::steady_clock::duration::zero();
+    }
+
+    if (args.options.anchor_window > 0) {
+        args.stream_options.anchor_window = args.options.anchor_window;
+    }
+
+    if (args.options.max_cost > 0) {
+        args.stream_options.max_cost = args.options.max_cost;
+    }
+
+    std::ofstream unused;
+    std::fstream file;
+    bool seekable = false;
+
+    if (!args.output.empty() && args.output != "-") {
+        file.open(args.output, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+
+        if (!file) {
+            throw std::system_error(errno, std::generic_category(), args.output);
+        }
+
+        seekable = std::filesystem::is_regular_file(args.output);
+    }
+
+    std::ostream& out = file.is_open() ? file : open_output(args, unused);
+    StreamDiff a(args.stream_options);
+    std::ifstream lhs = open_input(args.files[0]);
+    std::ifstream rhs = open_input(args.files[1]);
+
+    if (args.text) {
+        a.diff(lhs, rhs, [&out](const OwnedPatch& p) {
+            out << p << '\n';
+        });
+    } else {
+        PatchHeader header;
+
+        if (seekable) {
+            // Sizes no input reaches until the real ones are known
+            header.source_size = UINT64_MAX;
+            header.target_size = UINT64_MAX;
+        } else {
+            describe_stream(args.files[0], header.source_size, header.source_hash);
+            describe_stream(args.files[1], header.target_size, header.target_hash);
+        }
+
+        PatchEncoder encoder(out, header, args.compression, nullptr);
+        a.diff(lhs, rhs, encoder);
+
+        if (seekable) {
+            header = PatchHeader();
+            header.source_size = a.lhs_size();
+            header.target_size = a.rhs_size();
+            header.source_hash = a.lhs_hash();
+            header.target_hash = a.rhs_hash();
+
+            if (!encoder.finish(header)) {
+                rewrite_header(file, header);
+            }
+        } else {
+            encoder.finish();
+        }
+    }
+
+    if (args.stats) {
+        write_stats(a.stats());
+    }
+}
 
-int main() {
-    Diff a;
+// Patches of pairs diffed before come from the cache directory when there is one
+template <class t_diff>
+static void run_diff(const Arguments& args, DiffKind kind, std::ostream& out) {
+    t_diff a(args.options);
+    mapped_file lhs(args.files[0]);
+    mapped_file rhs(args.files[1]);
 
-    auto lhs = std::string("goore wormen");
-    auto rhs = std::string("guur feesten");
+    if (args.text) {
+        a.diff(lhs, rhs, [&out](const Patch& p) {
+            out << p << '\n';
+        });
+    } else {
+        std::unique_ptr<PatchCache> cache = args.cache.directory.empty() ? nullptr : std::make_unique<PatchCache>(args.cache);
+        PatchCompression compression = args.compression;
+        compression.threads = static_cast<unsigned>(args.options.threads);
+        encode_patch(a, kind, args.options, sequence_view(lhs.data(), 0, lhs.size()), sequence_view(rhs.data(), 0, rhs.size()), out, cache.get(), compression);
+    }
+
+    if (args.stats) {
+        write_stats(a.stats());
+    }
+}
+
+// Opens the cache directory, if any, for the pairs of a batch or a tree, and passes on
+// the compression
+static BatchOptions batch_options(const Arguments& args, std::unique_ptr<PatchCache>& cache) {
+    BatchOptions batch;
+    batch.compression = args.compression;
+
+    if (!args.cache.directory.empty()) {
+        cache = std::make_unique<PatchCache>(args.cache);
+        batch.cache = cache.get();
+    }
+
+    return batch;
+}
+
+// Diffs every pair of the manifest into its patch file and prints a status line
+// per pair as it finishes
+static int run_batch(const Arguments& args) {
+    std::ifstream manifest = open_input(args.batch);
+    std::vector<BatchJob> jobs = read_manifest(manifest);
+    std::unique_ptr<PatchCache> cache;
+    BatchDiff batch(args.options, batch_options(args, cache));
+    size_t failed = 0;
+
+    batch.run(jobs, [&args, &jobs, &failed](const BatchResult& r) {
+        const BatchJob& job = jobs[r.index];
+
+        if (r.ok) {
+            std::cout << "ok\t" << job.patch << '\t' << r.patch_size;
+
+            if (args.stats) {
+                std::cout << '\t';
+                r.stats.write_json(std::cout);
+            }
+
+            std::cout << '\n';
+        } else {
+            std::cout << "error\t" << job.patch << '\t' << r.error << '\n';
+            failed++;
+        }
+    });
+
+    std::cout.flush();
+
+    return failed > 0 ? 1 : 0;
+}
+
+// Prints a line per file that differs between the trees. With -o the patches of
+// modified files are written below that directory.
+static int run_tree(const Arguments& args) {
+    std::unique_ptr<PatchCache> cache;
+    TreeDiff tree(args.options, batch_options(args, cache));
+    size_t failed = 0;
+
+    auto print = [](const TreeEntry& e) {
+        if (e.change == TreeChange::Renamed) {
+            std::cout << to_string(e.change) << '\t' << e.lhs << '\t' << e.rhs;
+        } else {
+            std::cout << to_string(e.change) << '\t' << (e.change == TreeChange::Removed ? e.lhs : e.rhs);
+        }
+    };
+
+    if (args.output.empty()) {
+        for (const auto& e : tree.compare(args.files[0], args.files[1])) {
+            if (e.change != TreeChange::Unchanged) {
+                print(e);
+                std::cout << '\n';
+            }
+        }
+
+        return 0;
+    }
+
+    tree.diff(args.files[0], args.files[1], args.output, [&args, &print, &failed](const TreeEntry& e, const BatchResult* r) {
+        if (e.change == TreeChange::Unchanged) {
+            return;
+        } else if (r != nullptr && !r->ok) {
+            std::cout << "error\t" << e.rhs << '\t' << r->error << '\n';
+            failed++;
+            return;
+        }
+
+        print(e);
+
+        if (r != nullptr) {
+            std::cout << '\t' << r->patch_size;
+
+            if (args.stats) {
+                std::cout << '\t';
+                r->stats.write_json(std::cout);
+            }
+        }
 
-    std::cout << lhs << std::endl;
-    std::cout << rhs << std::endl;
+        std::cout << '\n';
+    });
 
-    auto v = a.diff(lhs, rhs);
+    std::cout.flush();
 
-    for (auto p : v) {
-        std::cout << p << std::endl;
+    return failed > 0 ? 1 : 0;
+}
+
+// Diffs the old file against every new file in one pass, into the patch named after
+// the new file in the -o directory, and prints a status line per patch
+static int run_targets(const Arguments& args) {
+    std::filesystem::path directory = args.output.empty() ? "." : args.output;
+    std::vector<std::filesystem::path> patches;
+
+    for (size_t i = 1; i < args.files.size(); i++) {
+        std::filesystem::path patch = directory / std::filesystem::path(args.files[i]).filename();
+        patch += ".bdp";
+
+        if (std::find(patches.begin(), patches.end(), patch) != patches.end()) {
+            throw std::invalid_argument(args.files[i] + ": another target has the same name");
+        }
+
+        patches.push_back(patch);
+    }
+
+    mapped_file base(args.files[0]);
+    std::vector<mapped_file> inputs;
+    std::vector<sequence_view> targets;
+    std::vector<std::ofstream> files(patches.size());
+    std::vector<std::ostream*> outs;
+
+    for (size_t i = 0; i < patches.size(); i++) {
+        inputs.emplace_back(args.files[i + 1]);
+        files[i].open(patches[i], std::ios::binary | std::ios::trunc);
+
+        if (!files[i]) {
+            throw std::system_error(errno, std::generic_category(), patches[i].string());
+        }
+
+        outs.push_back(&files[i]);
     }
 
-    system("pause");
-}
\ No newline at end of file
+    for (const auto& input : inputs) {
+        targets.push_back(sequence_view(input.data(), 0, input.size()));
+    }
+
+    MultiDiff multi(args.options);
+    multi.encode(sequence_view(base.data(), 0, base.size()), targets, outs, args.compression);
+
+    for (size_t i = 0; i < patches.size(); i++) {
+        std::cout << "ok\t" << patches[i].string() << '\t' << files[i].tellp() << '\n';
+    }
+
+    std::cout.flush();
+
+    return 0;
+}
+
+// Prints a line per region of the base that either side changed: how, and the
+// [begin, end) ranges of the base, our side and their side. Exits with 1 when a
+// region conflicts.
+static int run_merge(const Arguments& args) {
+    mapped_file base(args.files[0]);
+    mapped_file ours(args.files[1]);
+    mapped_file theirs(args.files[2]);
+    MultiDiff multi(args.options);
+    bool conflict = false;
+
+    for (const auto& h : multi.merge(sequence_view(base.data(), 0, base.size()), sequence_view(ours.data(), 0, ours.size()),
+        sequence_view(theirs.data(), 0, theirs.size())))
+    {
+        std::cout << to_string(h.change) << '\t' << h.base_begin << '\t' << h.base_end << '\t' << h.ours_begin << '\t' << h.ours_end << '\t'
+            << h.theirs_begin << '\t' << h.theirs_end << '\n';
+        conflict = conflict || h.change == MergeChange::Conflict;
+    }
+
+    std::cout.flush();
+
+    return conflict ? 1 : 0;
+}
+
+static uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static std::string read_input(const std::string& path) {
+    std::ifstream in = open_input(path);
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+
+    return buffer.str();
+}
+
+// Time of a profiled pair in each phase, in nanoseconds
+struct profile_phases {
+    uint64_t load = 0;
+    uint64_t trim = 0;
+    uint64_t index = 0;
+    uint64_t myers = 0;
+    uint64_t coalesce = 0;
+    uint64_t encode = 0;
+    uint64_t write = 0;
+    uint64_t patch_size = 0;
+
+    void add(const profile_phases& other) {
+        load += other.load;
+        trim += other.trim;
+        index += other.index;
+        myers += other.myers;
+        coalesce += other.coalesce;
+        encode += other.encode;
+        write += other.write;
+        patch_size += other.patch_size;
+    }
+
+    void print(const std::string& name) const {
+        std::cout << name;
+
+        for (uint64_t ns : { load, trim, index, myers, coalesce, encode, write }) {
+            std::cout << '\t' << ns / 1000;
+        }
+
+        std::cout << '\t' << patch_size << '\n';
+    }
+};
+
+// Sinks of a profiled diff that time the encoder, and the edit script with the
+// encoder in it
+struct timed_encoder {
+    PatchEncoder& encoder;
+    uint64_t& ns;
+
+    void operator() (const Edit& e) {
+        uint64_t begin = now_ns();
+        encoder(e);
+        ns += now_ns() - begin;
+    }
+};
+
+struct timed_script {
+    BasicEditCoalescer<char, timed_encoder>& script;
+    uint64_t& ns;
+
+    void operator() (const Patch& p) {
+        uint64_t begin = now_ns();
+        script(p);
+        ns += now_ns() - begin;
+    }
+};
+
+// The pairs of a corpus are the files <name>.old and <name>.new in the directory
+static std::vector<std::string> corpus_pairs(const std::string& directory) {
+    std::vector<std::string> names;
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        std::filesystem::path path = entry.path();
+
+        if (path.extension() == ".old" && std::filesystem::is_regular_file(std::filesystem::path(path).replace_extension(".new"))) {
+            names.push_back(path.stem().string());
+        }
+    }
+
+    std::sort(names.begin(), names.end());
+
+    return names;
+}
+
+// Replays every pair of the corpus through the byte diff and prints the time of
+// each phase in microseconds, a line per pair and one for the whole corpus. Only
+// with -o are the patches written. --trace writes the spans as a Chrome trace.
+static int run_profile(Arguments& args) {
+    std::filesystem::path corpus = args.files[0];
+    std::vector<std::string> names = corpus_pairs(args.files[0]);
+
+    if (names.empty()) {
+        throw std::invalid_argument(args.files[0] + ": no <name>.old and <name>.new pairs");
+    }
+
+    // Without a trace file the spans of the diff only count towards the phases
+    TraceRecorder trace(6, args.trace.empty() ? UINT64_MAX : uint64_t(1) << 16);
+    args.options.trace = &trace;
+
+    Diff diff(args.options);
+    profile_phases corpus_total;
+
+    std::cout << "pair\tload\ttrim\tindex\tmyers\tcoalesce\tencode\twrite\tpatch\n";
+
+    for (const auto& name : names) {
+        profile_phases phases;
+        uint64_t pair_begin = trace.now();
+
+        uint64_t begin = trace.now();
+        std::string lhs = read_input((corpus / (name + ".old")).string());
+        std::string rhs = read_input((corpus / (name + ".new")).string());
+        trace.record("load", 0, begin, lhs.size() + rhs.size());
+        phases.load = trace.now() - begin;
+
+        begin = trace.now();
+        sequence_view lhs_view(lhs.data(), 0, lhs.size());
+        sequence_view rhs_view(rhs.data(), 0, rhs.size());
+        std::ostringstream out;
+        PatchEncoder encoder(out, PatchHeader::describe(lhs.data(), lhs.size(), rhs.data(), rhs.size()), args.compression, lhs.data());
+        phases.encode = trace.now() - begin;
+
+        uint64_t encoding = 0;
+        uint64_t scripting = 0;
+        timed_encoder timed { encoder, encoding };
+        BasicEditCoalescer<char, timed_encoder> script(lhs_view, rhs_view, timed);
+
+        uint64_t trim = trace.total_ns("trim");
+        uint64_t index = trace.total_ns("index");
+
+        begin = trace.now();
+        diff.diff(lhs_view, rhs_view, timed_script { script, scripting });
+        uint64_t searched = trace.now() - begin;
+
+        phases.trim = trace.total_ns("trim") - trim;
+        phases.index = trace.total_ns("index") - index;
+        phases.myers = searched - phases.trim - phases.index - scripting;
+
+        begin = trace.now();
+        script.finish();
+        scripting += trace.now() - begin;
+        phases.coalesce = scripting - encoding;
+
+        begin = trace.now();
+        encoder.finish();
+        phases.encode += encoding + trace.now() - begin;
+
+        std::string patch = out.str();
+        phases.patch_size = patch.size();
+
+        if (!args.output.empty()) {
+            begin = trace.now();
+            std::filesystem::path path = std::filesystem::path(args.output) / (name + ".bdp");
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(patch.data(), static_cast<std::streamsize>(patch.size()));
+
+            if (!file.flush()) {
+                throw std::system_error(errno, std::generic_category(), path.string());
+            }
+
+            trace.record("write", 0, begin, patch.size());
+            phases.write = trace.now() - begin;
+        }
+
+        trace.record("pair", 0, pair_begin, lhs.size() + rhs.size());
+        phases.print(name);
+        corpus_total.add(phases);
+    }
+
+    corpus_total.print("total");
+    std::cout.flush();
+
+    if (!args.trace.empty()) {
+        std::ofstream file(args.trace, std::ios::binary | std::ios::trunc);
+        trace.write_chrome_json(file);
+
+        if (!file.flush()) {
+            throw std::system_error(errno, std::generic_category(), args.trace);
+        }
+    }
+
+    return 0;
+}
+
+// Rebuilds the new file from the old one, "-" writes it to stdout
+static int run_apply(int argc, char** argv) {
+    if (argc != 5) {
+        return usage(argv[0]);
+    }
+
+    try {
+        std::string target = argv[4];
+
+        if (target == "-") {
+            Arguments args;
+            std::ofstream file;
+            std::ostream& out = open_output(args, file);
+            mapped_file source(argv[2]);
+            mapped_file patch(argv[3]);
+
+            apply_patch(source.data(), source.size(), patch.data(), patch.size(), out);
+        } else {
+            apply_patch_file(argv[2], argv[3], target);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Arguments args;
+
+    if (argc > 1 && std::string(argv[1]) == "apply") {
+        return run_apply(argc, argv);
+    }
+
+    int first = 1;
+
+    if (argc > 1 && std::string(argv[1]) == "profile") {
+        args.profile = true;
+        first = 2;
+    }
+
+    for (int i = first; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-j" && i + 1 < argc) {
+            if (!parse_number(argv[++i], size_t(1), thread_pool::max_threads(), args.options.threads)) {
+                return usage(argv[0]);
+            }
+        } else if (arg == "-a" && i + 1 < argc) {
+            if (!parse_number(argv[++i], size_t(0), SIZE_MAX, args.options.anchor_window)) {
+                return usage(argv[0]);
+            }
+        } else if (arg == "-c" && i + 1 < argc) {
+            if (!parse_number(argv[++i], size_t(0), SIZE_MAX, args.options.max_cost)) {
+                return usage(argv[0]);
+            }
+        } else if (arg == "-b" && i + 1 < argc) {
+            if (!parse_number(argv[++i], size_t(0), SIZE_MAX, args.options.block_size)) {
+                return usage(argv[0]);
+            }
+        } else if (arg == "--stream") {
+            args.stream = true;
+        } else if (arg == "--batch" && i + 1 < argc) {
+            args.batch = argv[++i];
+        } else if (arg == "--targets") {
+            args.targets = true;
+        } else if (arg == "--merge") {
+            args.merge = true;
+        } else if (arg == "--lines") {
+            args.lines = true;
+        } else if (arg == "-w" && i + 1 < argc) {
+            if (!parse_number(argv[++i], size_t(1), SIZE_MAX, args.stream_options.window_size)) {
+                return usage(argv[0]);
+            }
+        } else if (arg == "--text") {
+            args.text = true;
+        } else if (arg == "-t" && i + 1 < argc) {
+            // Seconds each diff may take, up to a year so deadlines stay representable
+            double seconds = 0;
+
+            if (!parse_number(argv[++i], 0.0, 365.0 * 24 * 3600, seconds)) {
+                return usage(argv[0]);
+            }
+
+            args.options.timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+        } else if (arg == "--progress") {
+            args.progress = true;
+        } else if (arg == "--stats") {
+            args.stats = true;
+        } else if (arg == "--cache" && i + 1 < argc) {
+            args.cache.directory = argv[++i];
+        } else if (arg == "--cache-size" && i + 1 < argc) {
+            uint64_t mib = 0;
+
+            if (!parse_number(argv[++i], uint64_t(0), UINT64_MAX >> 20, mib)) {
+                return usage(argv[0]);
+            }
+
+            args.cache.disk_limit = mib << 20;
+        } else if (arg == "-z" && i + 1 < argc) {
+            // zstd's own level range, negative levels trade size for speed
+            if (!parse_number(argv[++i], -(1 << 17), 22, args.compression.level)) {
+                return usage(argv[0]);
+            }
+        } else if (arg == "--trace" && i + 1 < argc && args.profile) {
+            args.trace = argv[++i];
+        } else if (arg == "-o" && i + 1 < argc) {
+            args.output = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            return usage(argv[0]);
+        } else {
+            args.files.push_back(arg);
+        }
+    }
+
+    if (args.stats && !DiffStats::enabled) {
+        std::cerr << argv[0] << ": --stats needs a build with BIN_DIFF_STATS" << std::endl;
+        return 2;
+    }
+
+    if (args.compression.enabled() && !PatchCompression::available) {
+        std::cerr << argv[0] << ": -z needs a build with BIN_DIFF_ZSTD" << std::endl;
+        return 2;
+    }
+
+    if (args.profile) {
+        bool others = args.stream || args.lines || args.text || args.progress || args.stats || args.targets || args.merge || !args.batch.empty() ||
+            !args.cache.directory.empty();
+
+        if (others || args.files.size() != 1) {
+            return usage(argv[0]);
+        }
+
+        try {
+            return run_profile(args);
+        } catch (const std::exception& e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (!args.batch.empty()) {
+        if (!args.files.empty() || args.targets || args.merge || args.stream || args.lines || args.text || args.progress || !args.output.empty()) {
+            return usage(argv[0]);
+        }
+
+        try {
+            return run_batch(args);
+        } catch (const std::exception& e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (args.targets || args.merge) {
+        bool others = args.stream || args.lines || args.text || args.progress || args.stats || !args.cache.directory.empty();
+        bool files = args.targets ? args.files.size() >= 2 : args.files.size() == 3 && args.output.empty() && !args.compression.enabled();
+
+        if (others || (args.targets && args.merge) || !files) {
+            return usage(argv[0]);
+        }
+
+        try {
+            return args.targets ? run_targets(args) : run_merge(args);
+        } catch (const std::exception& e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (args.files.size() != 2 || (args.stream && (args.lines || args.progress || !args.cache.directory.empty()))) {
+        return usage(argv[0]);
+    }
+
+    if (std::filesystem::is_directory(args.files[0]) && std::filesystem::is_directory(args.files[1])) {
+        if (args.stream || args.lines || args.text || args.progress) {
+            return usage(argv[0]);
+        }
+
+        try {
+            return run_tree(args);
+        } catch (const std::exception& e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (args.progress) {
+        args.options.progress = [](uint64_t resolved, uint64_t total) {
+            std::cerr << '\r' << (total > 0 ? 100 * resolved / total : 100) << '%' << (resolved == total ? "\n" : "") << std::flush;
+        };
+    }
+
+    try {
+        if (args.stream) {
+            run_stream(args);
+            return 0;
+        }
+
+        std::ofstream file;
+        std::ostream& out = open_output(args, file);
+
+        if (args.lines) {
+            run_diff<LineDiff>(args, DiffKind::Lines, out);
+        } else {
+            run_diff<Diff>(args, DiffKind::Bytes, out);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,176 @@
+#include <cstddef>
+
+#include <cerrno>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "async_io.hpp"
+#include "batch_diff.hpp"
+#include "check.hpp"
+#include "mapped_file.hpp"
+#include "patch_apply.hpp"
+
+// Built twice, once as is and once with BIN_DIFF_IO_URING=0, so both the ring and
+// the pread fallback are tested wherever the ring is allowed
+
+static void write_file(const std::filesystem::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+static std::string read_file(const std::filesystem::path& path) {
+    mapped_file f(path.string());
+    return std::string(f.data(), f.size());
+}
+
+static int error_code(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const std::system_error& e) {
+        return e.code().value();
+    } catch (...) {
+        return -1;
+    }
+}
+
+// Files of many chunks at once, more than the ring holds, and an empty one, written
+// then read back
+static void test_round_trip(const std::filesystem::path& directory) {
+    std::mt19937 random(24);
+    std::vector<std::string> contents;
+
+    for (size_t i = 0; i < 12; i++) {
+        contents.push_back(i == 0 ? std::string() : random_bytes(random, (size_t(6) << 20) + random() % 4096, 256));
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> read(contents.size());
+    size_t failed = 0;
+
+    {
+        async_io io;
+
+        for (size_t i = 0; i < contents.size(); i++) {
+            io.write_file((directory / std::to_string(i)).string(), contents[i], [&mutex, &failed](std::exception_ptr error) {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed += error ? 1 : 0;
+            });
+        }
+
+        io.wait();
+        CHECK(failed == 0);
+
+        for (size_t i = 0; i < contents.size(); i++) {
+            CHECK(read_file(directory / std::to_string(i)) == contents[i]);
+
+            io.read_file((directory / std::to_string(i)).string(), [&mutex, &failed, &read, i](std::string data, std::exception_ptr error) {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed += error ? 1 : 0;
+                read[i] = std::move(data);
+            });
+        }
+    }
+
+    CHECK(failed == 0);
+    CHECK(read == contents);
+
+    std::cout << (async_io().uses_io_uring() ? "io_uring" : "pread fallback") << std::endl;
+}
+
+// Errors reach the callback as a system_error, and the requests around them still complete
+static void test_errors(const std::filesystem::path& directory) {
+    std::filesystem::create_directories(directory / "directory");
+    write_file(directory / "present", "present");
+
+    int missing = 0;
+    int is_directory = 0;
+    int unwritable = 0;
+    std::string present;
+
+    {
+        async_io io;
+
+        io.read_file((directory / "missing").string(), [&missing](std::string, std::exception_ptr error) {
+            missing = error ? error_code(error) : 0;
+        });
+        io.read_file((directory / "directory").string(), [&is_directory](std::string, std::exception_ptr error) {
+            is_directory = error ? error_code(error) : 0;
+        });
+        io.write_file((directory / "missing" / "file").string(), "data", [&unwritable](std::exception_ptr error) {
+            unwritable = error ? error_code(error) : 0;
+        });
+        io.read_file((directory / "present").string(), [&present](std::string data, std::exception_ptr error) {
+            present = error ? std::string() : data;
+        });
+    }
+
+    CHECK(missing == ENOENT);
+    CHECK(is_directory == EISDIR);
+    CHECK(unwritable == ENOENT);
+    CHECK(present == "present");
+}
+
+// More pairs than lanes, so inputs are read ahead and patches written behind the
+// diffs, with a pair that cannot be read among them
+static void test_batch(const std::filesystem::path& directory) {
+    std::mt19937 random(24);
+    std::vector<BatchJob> jobs;
+    std::vector<std::string> sources, targets;
+
+    for (size_t i = 0; i < 16; i++) {
+        std::string source = random_bytes(random, 4000 + random() % 4000);
+        std::string target = mutate(random, source, 4);
+        std::string name = "pair" + std::to_string(i);
+
+        if (i != 5) {
+            write_file(directory / (name + ".old"), source);
+        }
+
+        write_file(directory / (name + ".new"), target);
+        jobs.push_back({ (directory / (name + ".old")).string(), (directory / (name + ".new")).string(), (directory / (name + ".bdp")).string() });
+        sources.push_back(source);
+        targets.push_back(target);
+    }
+
+    DiffOptions options;
+    options.threads = 2;
+
+    for (size_t prefetch : { 1, 4 }) {
+        BatchOptions batch;
+        batch.prefetch = prefetch;
+
+        auto results = BatchDiff(options, batch).run(jobs);
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            CHECK(results[i].index == i);
+            CHECK(results[i].ok == (i != 5));
+
+            if (results[i].ok) {
+                std::string patch = read_file(jobs[i].patch);
+                CHECK(results[i].patch_size == patch.size());
+                CHECK(apply_patch(sources[i].data(), sources[i].size(), patch.data(), patch.size()) == targets[i]);
+            }
+        }
+    }
+}
+
+int main() {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("bin-diff-test-" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(directory);
+
+    test_round_trip(directory);
+    test_errors(directory);
+    test_batch(directory);
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+
+    return report();
+}
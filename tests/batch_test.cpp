@@ -0,0 +1,73 @@
+#include <cstddef>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "batch_diff.hpp"
+#include "check.hpp"
+#include "mapped_file.hpp"
+#include "patch_apply.hpp"
+
+static void write_file(const std::filesystem::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+// The timeout starts over for every pair, so a pair that runs out of time only
+// fails itself and the pairs queued behind it still get the whole of it
+static void test_timeout() {
+    std::mt19937 random(20);
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("bin-diff-test-" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(directory);
+
+    // Unrelated inputs cost a search far longer than the timeout
+    std::vector<BatchJob> jobs;
+    std::vector<std::string> sources, targets;
+
+    for (size_t i = 0; i < 5; i++) {
+        std::string source = random_bytes(random, i == 0 ? 200000 : 2000);
+        std::string target = i == 0 ? random_bytes(random, 200000) : source;
+
+        for (int e = 0; i > 0 && e < 4; e++) {
+            target[random() % target.size()] ^= 1;
+        }
+
+        std::string name = std::to_string(i);
+        write_file(directory / (name + ".old"), source);
+        write_file(directory / (name + ".new"), target);
+        jobs.push_back({ (directory / (name + ".old")).string(), (directory / (name + ".new")).string(), (directory / (name + ".bdp")).string() });
+        sources.push_back(source);
+        targets.push_back(target);
+    }
+
+    for (size_t prefetch : { 0, 2 }) {
+        DiffOptions options;
+        options.timeout = std::chrono::milliseconds(500);
+
+        BatchOptions batch;
+        batch.prefetch = prefetch;
+
+        auto results = BatchDiff(options, batch).run(jobs);
+        CHECK(!results[0].ok && results[0].error == "diff deadline exceeded");
+
+        for (size_t i = 1; i < jobs.size(); i++) {
+            CHECK(results[i].ok);
+
+            mapped_file patch(jobs[i].patch);
+            CHECK(apply_patch(sources[i].data(), sources[i].size(), patch.data(), patch.size()) == targets[i]);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+int main() {
+    test_timeout();
+
+    return report();
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <iostream>
+#include <random>
+#include <string>
+
+// The checks of the test programs. A failed check prints where it is and the test
+// goes on, main returns report() so ctest sees every failure of a run at once.
+namespace test_detail {
+    inline int failures = 0;
+
+    inline void fail(const char* file, int line, const char* what) {
+        std::cerr << file << ':' << line << ": check failed: " << what << std::endl;
+        failures++;
+    }
+
+    template <class t_error, class t_fn>
+    bool throws(t_fn&& fn) {
+        try {
+            fn();
+        } catch (const t_error&) {
+            return true;
+        } catch (...) {
+            return false;
+        }
+
+        return false;
+    }
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            test_detail::fail(__FILE__, __LINE__, #condition); \
+        } \
+    } while (false)
+
+// Checks that the statement throws t_error, and nothing else
+#define CHECK_THROWS(t_error, statement) \
+    do { \
+        if (!test_detail::throws<t_error>([&] { statement; })) { \
+            test_detail::fail(__FILE__, __LINE__, #statement " throws " #t_error); \
+        } \
+    } while (false)
+
+inline int report() {
+    if (test_detail::failures > 0) {
+        std::cerr << test_detail::failures << " checks failed" << std::endl;
+    }
+
+    return test_detail::failures > 0 ? 1 : 0;
+}
+
+// Bytes from a small alphabet, so diffs find matches in random data
+inline std::string random_bytes(std::mt19937& random, size_t size, int alphabet = 8) {
+    std::string bytes(size, '\0');
+
+    for (auto& b : bytes) {
+        b = static_cast<char>('a' + random() % static_cast<unsigned>(alphabet));
+    }
+
+    return bytes;
+}
+
+// bytes with edits random inserts, erases, flips and copies of its own ranges
+inline std::string mutate(std::mt19937& random, const std::string& bytes, int edits) {
+    std::string t = bytes;
+
+    for (int e = 0; e < edits; e++) {
+        size_t at = random() % (t.size() + 1);
+
+        switch (random() % 4) {
+            case 0:
+                t.insert(at, random_bytes(random, random() % 200, 26));
+                break;
+            case 1:
+                t.erase(at, random() % 200);
+                break;
+            case 2:
+                if (at < t.size()) {
+                    t[at] ^= 1;
+                }
+                break;
+            default:
+                if (!t.empty()) {
+                    size_t from = random() % t.size();
+                    t.insert(at, t.substr(from, random() % 3000));
+                }
+                break;
+        }
+    }
+
+    return t;
+}
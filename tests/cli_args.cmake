@@ -0,0 +1,39 @@
+# Checks that bin-diff takes numeric flags in range and answers anything else with
+# its usage and exit code 2. Run with -DBIN_DIFF=<bin-diff> -DDIR=<scratch>.
+file(REMOVE_RECURSE ${DIR})
+file(MAKE_DIRECTORY ${DIR})
+file(WRITE ${DIR}/old "the quick brown fox jumps over the lazy dog\n")
+file(WRITE ${DIR}/new "the quick red fox jumps over the lazy dog\n")
+
+function(expect code)
+    execute_process(COMMAND ${BIN_DIFF} ${ARGN} ${DIR}/old ${DIR}/new RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+
+    if(NOT result EQUAL code)
+        string(REPLACE ";" " " command "${ARGN}")
+        message(FATAL_ERROR "bin-diff ${command} exited with ${result}, not ${code}")
+    endif()
+endfunction()
+
+expect(0 -j 2 -a 16 -c 1000 -b 64 -t 10 --text)
+expect(0 --stream -w 4096)
+expect(0 --cache ${DIR}/cache --cache-size 1)
+
+foreach(bad -1 0 abc 2x 1e3 99999999 18446744073709551615)
+    expect(2 -j ${bad})
+endforeach()
+
+foreach(flag -a -c -b -w --cache-size)
+    foreach(bad -1 abc 7x 1.5 " 8")
+        expect(2 ${flag} ${bad})
+    endforeach()
+endforeach()
+
+foreach(bad -1 nan inf 1e30 5s)
+    expect(2 -t ${bad})
+endforeach()
+
+expect(2 -w 0)
+expect(2 --cache-size 18446744073709551615)
+expect(2 -z 3x)
+
+file(REMOVE_RECURSE ${DIR})
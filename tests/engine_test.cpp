@@ -0,0 +1,104 @@
+#include <cstddef>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include "bindiff.hpp"
+#include "cancel_token.hpp"
+#include "check.hpp"
+#include "diff_trace.hpp"
+
+// Only the installed headers, the engine comes from the bindiff library
+
+static std::string read_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::filesystem::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+static void test_round_trip() {
+    std::mt19937 random(27);
+    std::string source = random_bytes(random, 20000);
+    std::string target = mutate(random, source, 10);
+
+    for (size_t threads : { 1, 4 }) {
+        DiffOptions options;
+        options.threads = threads;
+        options.parallel_cutoff = 1 << 10;
+
+        DiffEngine engine(options);
+
+        for (DiffKind kind : { DiffKind::Bytes, DiffKind::Lines }) {
+            DiffResult result = engine.diff(source.data(), source.size(), target.data(), target.size(), kind);
+            CHECK(!result.cached);
+            CHECK(DiffEngine::apply(source.data(), source.size(), result.patch.data(), result.patch.size()) == target);
+        }
+    }
+}
+
+static void test_files() {
+    std::mt19937 random(27);
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("bin-diff-test-" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(directory);
+
+    std::string source = random_bytes(random, 20000);
+    std::string target = mutate(random, source, 10);
+    write_file(directory / "source", source);
+    write_file(directory / "target", target);
+
+    DiffEngine engine;
+    write_file(directory / "patch", engine.diff_files((directory / "source").string(), (directory / "target").string()).patch);
+    DiffEngine::apply_files((directory / "source").string(), (directory / "patch").string(), (directory / "out").string());
+    CHECK(read_file(directory / "out") == target);
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+// The token and the recorder the options point to are made from the installed headers
+static void test_cancel_and_trace() {
+    std::mt19937 random(27);
+    std::string source = random_bytes(random, 20000);
+    std::string target = mutate(random, source, 10);
+
+    cancel_token token;
+    TraceRecorder trace(6, 0);
+
+    DiffOptions options;
+    options.cancel = &token;
+    options.trace = &trace;
+
+    DiffEngine engine(options);
+
+    token.cancel();
+    CHECK_THROWS(DiffCancelled, engine.diff(source.data(), source.size(), target.data(), target.size()));
+
+    token.reset();
+    DiffResult result = engine.diff(source.data(), source.size(), target.data(), target.size());
+    CHECK(DiffEngine::apply(source.data(), source.size(), result.patch.data(), result.patch.size()) == target);
+    CHECK(!trace.events().empty());
+
+    // Unrelated inputs take far longer than the timeout
+    DiffOptions timed;
+    timed.timeout = std::chrono::milliseconds(100);
+
+    std::string unrelated = random_bytes(random, 200000);
+    std::string other = random_bytes(random, 200000);
+    CHECK_THROWS(DiffCancelled, DiffEngine(timed).diff(unrelated.data(), unrelated.size(), other.data(), other.size()));
+}
+
+int main() {
+    test_round_trip();
+    test_files();
+    test_cancel_and_trace();
+
+    return report();
+}
@@ -0,0 +1,107 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "match.hpp"
+
+using kernel = size_t (*)(const char*, const char*, size_t);
+
+struct variant {
+    const char* name;
+    kernel forward;
+    kernel backward;
+};
+
+static size_t naive_forward(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+
+    return i;
+}
+
+static size_t naive_backward(const char* a_end, const char* b_end, size_t n) {
+    size_t i = 0;
+
+    while (i < n && a_end[-1 - static_cast<ptrdiff_t>(i)] == b_end[-1 - static_cast<ptrdiff_t>(i)]) {
+        i++;
+    }
+
+    return i;
+}
+
+// The kernels this build has that the CPU runs, and the entry points of the diff
+static std::vector<variant> variants() {
+    std::vector<variant> v = {
+        { "portable", match_detail::forward_portable, match_detail::backward_portable },
+        { "match", match_forward, match_backward },
+    };
+
+#if BIN_DIFF_DISPATCH
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        v.push_back({ "avx2", match_detail::forward_avx2, match_detail::backward_avx2 });
+    }
+
+    if (__builtin_cpu_supports("avx512bw")) {
+        v.push_back({ "avx512", match_detail::forward_avx512, match_detail::backward_avx512 });
+    }
+#endif
+
+    return v;
+}
+
+// Every length up to a few vectors, at many alignments of both inputs, with one
+// difference at every position or none at all. The bytes around the inputs differ,
+// so a kernel that counts past its range fails.
+static void test_kernel(const variant& k) {
+    std::mt19937 random(27);
+    constexpr size_t max_size = 300;
+    std::string bytes = random_bytes(random, max_size, 256);
+
+    for (size_t a_offset = 0; a_offset < 64; a_offset += 7) {
+        size_t b_offset = (5 * a_offset + 3) % 64;
+        std::string a(128 + max_size, 'a');
+        std::string b(128 + max_size, 'b');
+        const char* pa = a.data() + 64 + a_offset;
+        const char* pb = b.data() + 64 + b_offset;
+
+        for (size_t n = 0; n <= max_size; n += n < 80 ? 1 : 13) {
+            for (size_t at = 0; at <= n; at++) {
+                a.replace(64 + a_offset, n, bytes, 0, n);
+                b.replace(64 + b_offset, n, bytes, 0, n);
+
+                if (at < n) {
+                    b[64 + b_offset + at] = static_cast<char>(b[64 + b_offset + at] ^ (1 << at % 8));
+                }
+
+                size_t forward = k.forward(pa, pb, n);
+                size_t backward = k.backward(pa + n, pb + n, n);
+
+                if (forward != naive_forward(pa, pb, n) || backward != naive_backward(pa + n, pb + n, n)) {
+                    std::cerr << k.name << ": offsets " << a_offset << ' ' << b_offset << " size " << n << " difference at " << at << std::endl;
+                    CHECK(forward == naive_forward(pa, pb, n));
+                    CHECK(backward == naive_backward(pa + n, pb + n, n));
+                    return;
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    for (const auto& k : variants()) {
+        std::cout << "testing " << k.name << std::endl;
+        test_kernel(k);
+    }
+
+    return report();
+}
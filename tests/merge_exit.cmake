@@ -0,0 +1,25 @@
+# Checks the exit codes of bin-diff --merge: 0 when the sides merge cleanly, 1 on a
+# conflict and 2 for a bad command line. Run with -DBIN_DIFF=<bin-diff> -DDIR=<scratch>.
+file(REMOVE_RECURSE ${DIR})
+file(MAKE_DIRECTORY ${DIR})
+file(WRITE ${DIR}/base "the quick brown fox jumps over the lazy dog\n")
+file(WRITE ${DIR}/ours "the quick red fox jumps over the lazy dog\n")
+file(WRITE ${DIR}/theirs "the quick brown fox jumps over the sleepy dog\n")
+file(WRITE ${DIR}/other "the quick blue fox jumps over the lazy dog\n")
+
+function(expect code)
+    execute_process(COMMAND ${BIN_DIFF} ${ARGN} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_QUIET)
+
+    if(NOT result EQUAL code)
+        string(REPLACE ";" " " command "${ARGN}")
+        message(FATAL_ERROR "bin-diff ${command} exited with ${result}, not ${code}:\n${output}")
+    endif()
+endfunction()
+
+expect(0 --merge ${DIR}/base ${DIR}/ours ${DIR}/theirs)
+expect(0 --merge ${DIR}/base ${DIR}/ours ${DIR}/ours)
+expect(1 --merge ${DIR}/base ${DIR}/ours ${DIR}/other)
+expect(2 --merge ${DIR}/base ${DIR}/ours)
+expect(2 --merge --targets ${DIR}/base ${DIR}/ours ${DIR}/theirs)
+
+file(REMOVE_RECURSE ${DIR})
@@ -0,0 +1,150 @@
+#include <cstddef>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "edit_script.hpp"
+#include "multi_diff.hpp"
+
+using multi_detail::change;
+
+static bool operator== (const change& a, const change& b) {
+    return a.base_begin == b.base_begin && a.base_end == b.base_end && a.target_begin == b.target_begin && a.target_end == b.target_end;
+}
+
+static bool operator== (const MergeHunk& a, const MergeHunk& b) {
+    return a.change == b.change && a.base_begin == b.base_begin && a.base_end == b.base_end && a.ours_begin == b.ours_begin &&
+        a.ours_end == b.ours_end && a.theirs_begin == b.theirs_begin && a.theirs_end == b.theirs_end;
+}
+
+static std::ostream& operator<< (std::ostream& out, const MergeHunk& h) {
+    return out << to_string(h.change) << ' ' << h.base_begin << ' ' << h.base_end << ' ' << h.ours_begin << ' ' << h.ours_end << ' '
+        << h.theirs_begin << ' ' << h.theirs_end;
+}
+
+static sequence_view view(const std::string& s) {
+    return sequence_view(s.data(), 0, s.size());
+}
+
+// An edit of lhs [lhs_begin, lhs_end) into rhs [rhs_begin, rhs_end), changes_of only
+// looks at the positions
+static Edit edit(EditOperation op, size_t lhs_begin, size_t lhs_end, size_t rhs_begin, size_t rhs_end) {
+    static const std::string input(64, 'x');
+
+    Edit e;
+    e.op = op;
+    e.lhs = sequence_view(input.data(), lhs_begin, lhs_end);
+    e.rhs = sequence_view(input.data(), rhs_begin, rhs_end);
+
+    return e;
+}
+
+static void test_changes_of() {
+    struct test_case {
+        const char* name;
+        std::vector<Edit> edits;
+        std::vector<change> changes;
+    };
+
+    const std::vector<test_case> cases = {
+        { "unchanged", { edit(EditOperation::Keep, 0, 8, 0, 8) }, { } },
+        { "delete", { edit(EditOperation::Keep, 0, 3, 0, 3), edit(EditOperation::Delete, 3, 5, 3, 3), edit(EditOperation::Keep, 5, 8, 3, 6) },
+            { { 3, 5, 3, 3 } } },
+        { "touching edits join", { edit(EditOperation::Delete, 0, 2, 0, 0), edit(EditOperation::Insert, 2, 2, 0, 3),
+            edit(EditOperation::Replace, 2, 3, 3, 4), edit(EditOperation::Keep, 3, 8, 4, 9) }, { { 0, 3, 0, 4 } } },
+        { "a keep splits", { edit(EditOperation::Insert, 0, 0, 0, 1), edit(EditOperation::Keep, 0, 4, 1, 5), edit(EditOperation::Delete, 4, 5, 5, 5) },
+            { { 0, 0, 0, 1 }, { 4, 5, 5, 5 } } },
+        { "moves add", { edit(EditOperation::Keep, 0, 2, 0, 2), edit(EditOperation::Move, 2, 2, 2, 4), edit(EditOperation::Keep, 2, 8, 4, 10) },
+            { { 2, 2, 2, 4 } } },
+    };
+
+    for (const auto& c : cases) {
+        auto changes = multi_detail::changes_of(c.edits);
+        bool same = changes.size() == c.changes.size();
+
+        for (size_t i = 0; same && i < changes.size(); i++) {
+            same = changes[i] == c.changes[i];
+        }
+
+        if (!same) {
+            std::cerr << "changes_of: " << c.name << std::endl;
+        }
+
+        CHECK(same);
+    }
+}
+
+// Each case is merged from its changes, and end to end by MultiDiff::merge, whose
+// diffs find the same changes for these inputs
+static void test_merge() {
+    struct test_case {
+        const char* name;
+        std::string ours;
+        std::string theirs;
+        std::vector<change> our_changes;
+        std::vector<change> their_changes;
+        std::vector<MergeHunk> hunks;
+    };
+
+    const std::string base = "abcdefgh";
+
+    const std::vector<test_case> cases = {
+        { "unchanged", base, base, { }, { }, { } },
+        { "ours only", "aXcdefgh", base, { { 1, 2, 1, 2 } }, { },
+            { { MergeChange::Ours, 1, 2, 1, 2, 1, 2 } } },
+        { "theirs only", base, "abcdefh", { }, { { 6, 7, 6, 6 } },
+            { { MergeChange::Theirs, 6, 7, 6, 7, 6, 6 } } },
+        { "same change", "aXcdefgh", "aXcdefgh", { { 1, 2, 1, 2 } }, { { 1, 2, 1, 2 } },
+            { { MergeChange::Both, 1, 2, 1, 2, 1, 2 } } },
+        { "different change", "aXcdefgh", "aYcdefgh", { { 1, 2, 1, 2 } }, { { 1, 2, 1, 2 } },
+            { { MergeChange::Conflict, 1, 2, 1, 2, 1, 2 } } },
+        { "same insert at one place", "abXcdefgh", "abXcdefgh", { { 2, 2, 2, 3 } }, { { 2, 2, 2, 3 } },
+            { { MergeChange::Both, 2, 2, 2, 3, 2, 3 } } },
+        { "different inserts at one place", "abXcdefgh", "abYcdefgh", { { 2, 2, 2, 3 } }, { { 2, 2, 2, 3 } },
+            { { MergeChange::Conflict, 2, 2, 2, 3, 2, 3 } } },
+        { "touching changes conflict", "aXYdefgh", "abcZefgh", { { 1, 3, 1, 3 } }, { { 3, 4, 3, 4 } },
+            { { MergeChange::Conflict, 1, 4, 1, 4, 1, 4 } } },
+        { "delete touching an insert", "abefgh", "abcdZefgh", { { 2, 4, 2, 2 } }, { { 4, 4, 4, 5 } },
+            { { MergeChange::Conflict, 2, 4, 2, 2, 2, 5 } } },
+        { "overlaps chain", "aXYZefgh", "abcQRgh", { { 1, 4, 1, 4 } }, { { 3, 6, 3, 5 } },
+            { { MergeChange::Conflict, 1, 6, 1, 6, 1, 5 } } },
+        { "unchanged ranges map through earlier changes", "aXYZcdefgh", "abcdeQgh", { { 1, 2, 1, 4 } }, { { 5, 6, 5, 6 } },
+            { { MergeChange::Ours, 1, 2, 1, 4, 1, 2 }, { MergeChange::Theirs, 5, 6, 7, 8, 5, 6 } } },
+        { "changes of both sides in turn", "bcdXfgh", "abcYdefgh", { { 0, 1, 0, 0 }, { 4, 5, 3, 4 } }, { { 3, 3, 3, 4 } },
+            { { MergeChange::Ours, 0, 1, 0, 0, 0, 1 }, { MergeChange::Theirs, 3, 3, 2, 2, 3, 4 }, { MergeChange::Ours, 4, 5, 3, 4, 5, 6 } } },
+    };
+
+    MultiDiff multi;
+
+    for (const auto& c : cases) {
+        auto hunks = multi_detail::merge(view(c.ours), view(c.theirs), c.our_changes, c.their_changes);
+        auto merged = multi.merge(view(base), view(c.ours), view(c.theirs));
+
+        for (const auto* result : { &hunks, &merged }) {
+            bool same = result->size() == c.hunks.size();
+
+            for (size_t i = 0; same && i < result->size(); i++) {
+                same = (*result)[i] == c.hunks[i];
+            }
+
+            if (!same) {
+                std::cerr << (result == &hunks ? "merge: " : "MultiDiff::merge: ") << c.name << std::endl;
+
+                for (const auto& h : *result) {
+                    std::cerr << "  " << h << std::endl;
+                }
+            }
+
+            CHECK(same);
+        }
+    }
+}
+
+int main() {
+    test_changes_of();
+    test_merge();
+
+    return report();
+}
@@ -0,0 +1,221 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "diff.hpp"
+#include "edit_script.hpp"
+#include "patch_apply.hpp"
+#include "patch_format.hpp"
+
+static std::string encode(const std::string& source, const std::string& target, const DiffOptions& options = DiffOptions()) {
+    sequence_view lhs(source.data(), 0, source.size());
+    sequence_view rhs(target.data(), 0, target.size());
+    std::ostringstream out;
+    PatchEncoder encoder(out, PatchHeader::describe(source.data(), source.size(), target.data(), target.size()));
+    BasicEditCoalescer<char, PatchEncoder> script(lhs, rhs, encoder);
+    Diff diff(options);
+    diff.diff(lhs, rhs, script);
+    script.finish();
+    encoder.finish();
+
+    return out.str();
+}
+
+static size_t count_records(const std::string& patch, PatchRecordType type) {
+    PatchDecoder decoder(patch.data(), patch.size());
+    PatchRecord record;
+    size_t count = 0;
+
+    while (decoder.next(record)) {
+        count += record.type == type ? 1 : 0;
+    }
+
+    return count;
+}
+
+static void write_file(const std::filesystem::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+static std::string read_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Every way to apply rebuilds the target, in place too
+static void check_apply(const std::string& source, const std::string& target, const DiffOptions& options) {
+    Diff diff(options);
+    auto patches = diff.diff(source, target);
+    CHECK(patched_size(source.size(), patches) == target.size());
+    CHECK(apply_patches(source.data(), source.size(), patches) == target);
+
+    std::string buffer = source;
+    apply_patches_in_place(buffer, patches);
+    CHECK(buffer == target);
+
+    sequence_view lhs(source.data(), 0, source.size());
+    sequence_view rhs(target.data(), 0, target.size());
+    CHECK(apply_edits(source.data(), source.size(), normalize(lhs, rhs, patches)) == target);
+
+    std::string patch = encode(source, target, options);
+    CHECK(apply_patch(source.data(), source.size(), patch.data(), patch.size()) == target);
+
+    std::string out(target.size(), '\0');
+    apply_patch(source.data(), source.size(), patch.data(), patch.size(), &out[0], out.size());
+    CHECK(out == target);
+
+    std::ostringstream stream;
+    apply_patch(source.data(), source.size(), patch.data(), patch.size(), stream);
+    CHECK(stream.str() == target);
+
+    buffer = source;
+    apply_patch_in_place(buffer, patch.data(), patch.size());
+    CHECK(buffer == target);
+}
+
+static void test_apply() {
+    std::mt19937 random(11);
+
+    for (int round = 0; round < 8; round++) {
+        std::string source = random_bytes(random, 1000 + random() % 8000);
+        std::string target = mutate(random, source, 1 + round * 2);
+        check_apply(source, target, DiffOptions());
+    }
+
+    // Shrinking and growing, which apply in place over the buffer and through a second one
+    std::string source = random_bytes(random, 4000);
+    check_apply(source, source.substr(1000, 2000), DiffOptions());
+    check_apply(source, source.substr(0, 1000) + random_bytes(random, 3000, 26) + source.substr(1000), DiffOptions());
+    check_apply(source, "", DiffOptions());
+    check_apply("", source, DiffOptions());
+}
+
+// Target blocks in another order become Move records, and Replace records come from
+// the edit script
+static void test_move_and_replace() {
+    std::mt19937 random(13);
+    std::vector<std::string> blocks;
+
+    for (int i = 0; i < 32; i++) {
+        blocks.push_back(random_bytes(random, 256, 256));
+    }
+
+    std::string source;
+
+    for (const auto& b : blocks) {
+        source += b;
+    }
+
+    std::shuffle(blocks.begin(), blocks.end(), random);
+    std::string target;
+
+    for (const auto& b : blocks) {
+        target += b;
+    }
+
+    DiffOptions options;
+    options.block_size = 64;
+    CHECK(count_records(encode(source, target, options), PatchRecordType::Move) > 0);
+    check_apply(source, target, options);
+
+    std::string replaced = source;
+
+    for (size_t at = 100; at < replaced.size(); at += 1000) {
+        replaced[at] = static_cast<char>(replaced[at] ^ 0x55);
+    }
+
+    CHECK(count_records(encode(source, replaced), PatchRecordType::Replace) > 0);
+    check_apply(source, replaced, DiffOptions());
+}
+
+// Entries of directory, so the tests see any temporary an apply leaves behind
+static size_t entries(const std::filesystem::path& directory) {
+    return static_cast<size_t>(std::distance(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator()));
+}
+
+static void test_apply_file() {
+    std::mt19937 random(17);
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("bin-diff-test-" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(directory);
+
+    std::string source = random_bytes(random, 20000);
+    std::string target = mutate(random, source, 10);
+    std::string patch = encode(source, target);
+    write_file(directory / "source", source);
+    write_file(directory / "patch", patch);
+
+    // Into a new file
+    apply_patch_file((directory / "source").string(), (directory / "patch").string(), (directory / "target").string());
+    CHECK(read_file(directory / "target") == target);
+    CHECK(read_file(directory / "source") == source);
+
+    // A wrong source and a damaged patch leave every file as it was
+    CHECK_THROWS(PatchApplyError, apply_patch_file((directory / "target").string(), (directory / "patch").string(), (directory / "other").string()));
+    CHECK(!std::filesystem::exists(directory / "other"));
+    CHECK(entries(directory) == 3);
+
+    std::string damaged = patch;
+    damaged[damaged.size() / 2] = static_cast<char>(damaged[damaged.size() / 2] ^ 1);
+    write_file(directory / "damaged", damaged);
+    CHECK_THROWS(PatchFormatError, apply_patch_file((directory / "source").string(), (directory / "damaged").string(), (directory / "source").string()));
+    CHECK(read_file(directory / "source") == source);
+    CHECK(entries(directory) == 4);
+
+    // A file that happens to have the name of the old temporary is left alone
+    write_file(directory / "target.tmp", "mine");
+    apply_patch_file((directory / "source").string(), (directory / "patch").string(), (directory / "target").string());
+    CHECK(read_file(directory / "target.tmp") == "mine");
+    CHECK(entries(directory) == 5);
+
+    // Concurrent applies to one target each write a temporary of their own
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&directory] {
+            apply_patch_file((directory / "source").string(), (directory / "patch").string(), (directory / "shared").string());
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    CHECK(read_file(directory / "shared") == target);
+    CHECK(entries(directory) == 6);
+
+    // Over the source itself
+    apply_patch_file((directory / "source").string(), (directory / "patch").string(), (directory / "source").string());
+    CHECK(read_file(directory / "source") == target);
+    CHECK(entries(directory) == 6);
+
+    // A replaced target keeps its permissions, the execute bit included
+    auto mode = std::filesystem::perms::owner_read | std::filesystem::perms::owner_write | std::filesystem::perms::owner_exec;
+    std::filesystem::permissions(directory / "shared", mode);
+    write_file(directory / "source", source);
+    apply_patch_file((directory / "source").string(), (directory / "patch").string(), (directory / "shared").string());
+    CHECK(read_file(directory / "shared") == target);
+    CHECK(std::filesystem::status(directory / "shared").permissions() == mode);
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+int main() {
+    test_apply();
+    test_move_and_replace();
+    test_apply_file();
+
+    return report();
+}
@@ -0,0 +1,271 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "diff.hpp"
+#include "edit_script.hpp"
+#include "hash.hpp"
+#include "patch_apply.hpp"
+#include "patch_format.hpp"
+#include "stream_diff.hpp"
+
+static std::string encode(const std::string& source, const std::string& target, const DiffOptions& options = DiffOptions()) {
+    std::ostringstream out;
+    PatchEncoder encoder(out, PatchHeader::describe(source.data(), source.size(), target.data(), target.size()));
+    Diff diff(options);
+    diff.diff(source, target, encoder);
+    encoder.finish();
+
+    return out.str();
+}
+
+// The same patch from the normalized edit script, which has Replace records
+static std::string encode_edits(const std::string& source, const std::string& target) {
+    sequence_view lhs(source.data(), 0, source.size());
+    sequence_view rhs(target.data(), 0, target.size());
+    std::ostringstream out;
+    PatchEncoder encoder(out, PatchHeader::describe(source.data(), source.size(), target.data(), target.size()));
+    BasicEditCoalescer<char, PatchEncoder> script(lhs, rhs, encoder);
+    Diff diff;
+    diff.diff(lhs, rhs, script);
+    script.finish();
+    encoder.finish();
+
+    return out.str();
+}
+
+// Walks the records and checks they consume the whole source and make the target
+static void check_records(const std::string& patch, const std::string& source, const std::string& target) {
+    PatchDecoder decoder(patch.data(), patch.size());
+    CHECK(decoder.header().source_size == source.size());
+    CHECK(decoder.header().target_size == target.size());
+    CHECK(decoder.header().source_hash == xxhash64::hash(source.data(), source.size()));
+    CHECK(decoder.header().target_hash == xxhash64::hash(target.data(), target.size()));
+    CHECK(!decoder.compressed());
+
+    uint64_t consumed = 0;
+    uint64_t produced = 0;
+    PatchRecord record;
+
+    while (decoder.next(record)) {
+        if (record.type == PatchRecordType::Copy) {
+            consumed += record.length;
+            produced += record.length;
+        } else if (record.type == PatchRecordType::Delete) {
+            consumed += record.length;
+        } else if (record.type == PatchRecordType::Replace) {
+            consumed += record.skipped;
+            produced += record.length;
+        } else {
+            produced += record.length;
+        }
+    }
+
+    CHECK(consumed == source.size());
+    CHECK(produced == target.size());
+}
+
+static void test_round_trip() {
+    std::mt19937 random(10);
+
+    for (int round = 0; round < 8; round++) {
+        std::string source = random_bytes(random, 1000 + random() % 8000);
+        std::string target = mutate(random, source, 1 + round * 2);
+
+        for (size_t anchor_window : { 0, 32 }) {
+            for (size_t block_size : { 0, 64 }) {
+                DiffOptions options;
+                options.anchor_window = anchor_window;
+                options.block_size = block_size;
+
+                std::string patch = encode(source, target, options);
+                CHECK(static_cast<uint8_t>(patch[4]) == PatchHeader::raw_version);
+                check_records(patch, source, target);
+                CHECK(apply_patch(source.data(), source.size(), patch.data(), patch.size()) == target);
+            }
+        }
+
+        std::string patch = encode_edits(source, target);
+        check_records(patch, source, target);
+        CHECK(apply_patch(source.data(), source.size(), patch.data(), patch.size()) == target);
+    }
+
+    // Empty inputs on either side
+    for (const auto& pair : std::vector<std::pair<std::string, std::string>>{ { "", "" }, { "abc", "" }, { "", "abc" } }) {
+        std::string patch = encode(pair.first, pair.second);
+        check_records(patch, pair.first, pair.second);
+        CHECK(apply_patch(pair.first.data(), pair.first.size(), patch.data(), patch.size()) == pair.second);
+    }
+}
+
+// The checksum covers every byte, so no cut or flipped bit gets past the decoder
+static void test_corruption() {
+    std::mt19937 random(11);
+    std::string source = random_bytes(random, 2000);
+    std::string target = mutate(random, source, 6);
+    std::string patch = encode_edits(source, target);
+
+    for (size_t size = 0; size < patch.size(); size++) {
+        CHECK_THROWS(PatchFormatError, PatchDecoder(patch.data(), size));
+    }
+
+    for (size_t bit = 0; bit < 8 * patch.size(); bit++) {
+        std::string flipped = patch;
+        flipped[bit / 8] = static_cast<char>(flipped[bit / 8] ^ (1 << bit % 8));
+        CHECK_THROWS(PatchFormatError, apply_patch(source.data(), source.size(), flipped.data(), flipped.size()));
+    }
+
+    // A sound patch for another source
+    std::string other = source;
+    other[0] = static_cast<char>(other[0] ^ 1);
+    CHECK_THROWS(PatchApplyError, apply_patch(other.data(), other.size(), patch.data(), patch.size()));
+}
+
+// Patches with a valid checksum over bad records
+static std::string sealed(uint8_t version, uint8_t flags, const std::string& records, uint64_t source_size, uint64_t target_size) {
+    using namespace patch_format_detail;
+
+    std::string patch(PatchHeader::magic, sizeof(PatchHeader::magic));
+    patch.push_back(static_cast<char>(version));
+    patch.push_back(static_cast<char>(flags));
+    patch.append(2, '\0');
+    put_u64(patch, source_size);
+    put_u64(patch, target_size);
+    put_u64(patch, 0);
+    put_u64(patch, 0);
+    patch += records;
+    put_u64(patch, xxhash64::hash(patch.data(), patch.size()));
+
+    return patch;
+}
+
+static void test_bad_records() {
+    std::string source = "abcdef";
+    ApplyOptions unverified;
+    unverified.verify = false;
+
+    auto apply = [&](const std::string& patch) {
+        return apply_patch(source.data(), source.size(), patch.data(), patch.size(), unverified);
+    };
+
+    // Copy 6 and End applies
+    CHECK(apply(sealed(PatchHeader::raw_version, 0, std::string("\x01\x06\x00", 3), 6, 6)) == source);
+
+    // Unknown tag, missing End, Insert running past the records, overlong varint
+    CHECK_THROWS(PatchFormatError, apply(sealed(PatchHeader::raw_version, 0, std::string("\x09\x06\x00", 3), 6, 6)));
+    CHECK_THROWS(PatchFormatError, apply(sealed(PatchHeader::raw_version, 0, std::string("\x01\x06", 2), 6, 6)));
+    CHECK_THROWS(PatchFormatError, apply(sealed(PatchHeader::raw_version, 0, std::string("\x02\x09xy\x00", 5), 6, 9)));
+    CHECK_THROWS(PatchFormatError, apply(sealed(PatchHeader::raw_version, 0, std::string(12, '\xff'), 6, 6)));
+
+    // Records that leave the source or the target
+    CHECK_THROWS(PatchApplyError, apply(sealed(PatchHeader::raw_version, 0, std::string("\x01\x07\x00", 3), 6, 7)));
+    CHECK_THROWS(PatchApplyError, apply(sealed(PatchHeader::raw_version, 0, std::string("\x01\x06\x00", 3), 6, 5)));
+    CHECK_THROWS(PatchApplyError, apply(sealed(PatchHeader::raw_version, 0, std::string("\x04\x03\x05\x00", 4), 6, 3)));
+
+    // Not a patch at all
+    CHECK_THROWS(PatchFormatError, apply(std::string(64, 'x')));
+}
+
+// Version 1 has no Replace, version 3 added compressed records. Raw patches of every
+// version decode the same.
+static void test_versions() {
+    std::string source = "abcdef";
+    ApplyOptions unverified;
+    unverified.verify = false;
+
+    auto apply = [&](const std::string& patch) {
+        return apply_patch(source.data(), source.size(), patch.data(), patch.size(), unverified);
+    };
+
+    // Copy 2, Delete 1, Insert "XY", Move 2 from 0, Copy 3, End
+    std::string records("\x01\x02\x03\x01\x02\x02XY\x04\x02\x00\x01\x03\x00", 14);
+
+    // Copy 2, Replace 1 by "XY", Copy 3, End
+    std::string replace("\x01\x02\x05\x02\x01XY\x01\x03\x00", 10);
+
+    for (uint8_t version = PatchHeader::min_version; version <= PatchHeader::version; version++) {
+        std::string patch = sealed(version, 0, records, 6, 9);
+        CHECK(PatchDecoder(patch.data(), patch.size()).version() == version);
+        CHECK(apply(patch) == "abXYabdef");
+
+        if (version >= 2) {
+            CHECK(apply(sealed(version, 0, replace, 6, 7)) == "abXYdef");
+        } else {
+            CHECK_THROWS(PatchFormatError, apply(sealed(version, 0, replace, 6, 7)));
+        }
+
+        std::string compressed = sealed(version, PatchHeader::zstd_records, records, 6, 9);
+
+        if (version >= 3) {
+            CHECK(PatchDecoder(compressed.data(), compressed.size()).compressed());
+        } else {
+            CHECK_THROWS(PatchFormatError, PatchDecoder(compressed.data(), compressed.size()));
+        }
+
+        CHECK_THROWS(PatchFormatError, apply(sealed(version, 2, records, 6, 9)));
+    }
+
+    CHECK_THROWS(PatchFormatError, apply(sealed(PatchHeader::min_version - 1, 0, records, 6, 9)));
+    CHECK_THROWS(PatchFormatError, apply(sealed(PatchHeader::version + 1, 0, records, 6, 9)));
+}
+
+// A streamed diff learns its header once the inputs are read. A patch still in the
+// encoder's buffer takes it in place, a larger one has it rewritten in the stream.
+static void test_late_header() {
+    std::mt19937 random(8);
+
+    for (size_t size : { size_t(20000), size_t(3) << 20 }) {
+        std::string source = random_bytes(random, size, 256);
+        std::string target = mutate(random, source, 10) + random_bytes(random, size / 2, 256);
+
+        PatchHeader unknown;
+        unknown.source_size = UINT64_MAX;
+        unknown.target_size = UINT64_MAX;
+
+        std::stringstream out;
+        PatchEncoder encoder(out, unknown);
+        std::istringstream lhs(source);
+        std::istringstream rhs(target);
+
+        StreamOptions options;
+        options.window_size = 1 << 16;
+
+        StreamDiff diff(options);
+        diff.diff(lhs, rhs, encoder);
+
+        PatchHeader header;
+        header.source_size = diff.lhs_size();
+        header.target_size = diff.rhs_size();
+        header.source_hash = diff.lhs_hash();
+        header.target_hash = diff.rhs_hash();
+
+        PatchHeader expected = PatchHeader::describe(source.data(), source.size(), target.data(), target.size());
+        CHECK(header.source_size == expected.source_size && header.source_hash == expected.source_hash);
+        CHECK(header.target_size == expected.target_size && header.target_hash == expected.target_hash);
+
+        bool in_place = encoder.finish(header);
+        CHECK(in_place == (size < (1 << 20)));
+
+        if (!in_place) {
+            rewrite_header(out, header);
+        }
+
+        std::string patch = out.str();
+        CHECK(apply_patch(source.data(), source.size(), patch.data(), patch.size()) == target);
+    }
+}
+
+int main() {
+    test_round_trip();
+    test_corruption();
+    test_bad_records();
+    test_versions();
+    test_late_header();
+
+    return report();
+}
@@ -0,0 +1,137 @@
+#include <cstddef>
+#include <cstdint>
+
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "diff.hpp"
+#include "patch_apply.hpp"
+#include "patch_format.hpp"
+
+// What ctest takes as skipped, see SKIP_RETURN_CODE in CMakeLists.txt
+constexpr int skipped = 77;
+
+static std::string encode(const std::string& source, const std::string& target, int level, const char* dictionary) {
+    PatchCompression compression;
+    compression.level = level;
+
+    std::ostringstream out;
+    PatchEncoder encoder(out, PatchHeader::describe(source.data(), source.size(), target.data(), target.size()), compression, dictionary);
+    Diff diff;
+    diff.diff(source, target, encoder);
+    encoder.finish();
+
+    return out.str();
+}
+
+static void test_round_trip() {
+    std::mt19937 random(26);
+    std::string source = random_bytes(random, 20000, 256);
+
+    // Inserts that repeat the source, which the source as dictionary makes cheap
+    std::string target = source.substr(0, 5000) + random_bytes(random, 300, 256) + source.substr(12000, 4000) + source.substr(5000);
+
+    for (int level : { -5, 1, 3, 19 }) {
+        for (const char* dictionary : { static_cast<const char*>(source.data()), static_cast<const char*>(nullptr) }) {
+            std::string patch = encode(source, target, level, dictionary);
+            CHECK(static_cast<uint8_t>(patch[4]) == PatchHeader::version);
+
+            PatchDecoder decoder(patch.data(), patch.size());
+            CHECK(decoder.compressed());
+
+            PatchRecord record;
+            CHECK_THROWS(PatchFormatError, decoder.next(record));
+
+            CHECK(apply_patch(source.data(), source.size(), patch.data(), patch.size()) == target);
+
+            std::ostringstream stream;
+            apply_patch(source.data(), source.size(), patch.data(), patch.size(), stream);
+            CHECK(stream.str() == target);
+
+            std::string buffer = source;
+            apply_patch_in_place(buffer, patch.data(), patch.size());
+            CHECK(buffer == target);
+        }
+    }
+
+    std::ostringstream raw;
+    PatchEncoder encoder(raw, PatchHeader::describe(source.data(), source.size(), target.data(), target.size()));
+    Diff diff;
+    diff.diff(source, target, encoder);
+    encoder.finish();
+    CHECK(encode(source, target, 3, source.data()).size() < raw.str().size());
+}
+
+static void test_corruption() {
+    std::mt19937 random(27);
+    std::string source = random_bytes(random, 4000, 256);
+    std::string target = mutate(random, source, 6);
+    std::string patch = encode(source, target, 3, source.data());
+
+    for (size_t bit = 0; bit < 8 * patch.size(); bit++) {
+        std::string flipped = patch;
+        flipped[bit / 8] = static_cast<char>(flipped[bit / 8] ^ (1 << bit % 8));
+        CHECK_THROWS(PatchFormatError, apply_patch(source.data(), source.size(), flipped.data(), flipped.size()));
+    }
+
+    // The source is checked before the records are unpacked against it
+    std::string other = random_bytes(random, source.size(), 256);
+    CHECK_THROWS(PatchApplyError, apply_patch(other.data(), other.size(), patch.data(), patch.size()));
+}
+
+// A frame may state any decompressed size, one past what the header allows is
+// refused before it is allocated
+static void test_frame_size() {
+#if BIN_DIFF_ZSTD
+    using namespace patch_format_detail;
+
+    std::mt19937 random(26);
+    std::string source = random_bytes(random, 4000, 256);
+    std::string target = mutate(random, source, 6);
+    PatchHeader header = PatchHeader::describe(source.data(), source.size(), target.data(), target.size());
+
+    for (uint64_t records_size : { max_records_size(header), max_records_size(header) + 1 }) {
+        std::string records(static_cast<size_t>(records_size), '\0');
+        std::string frame(ZSTD_compressBound(records.size()), '\0');
+        frame.resize(ZSTD_compress(&frame[0], frame.size(), records.data(), records.size(), 1));
+
+        std::string patch(PatchHeader::magic, sizeof(PatchHeader::magic));
+        patch.push_back(static_cast<char>(PatchHeader::version));
+        patch.push_back(static_cast<char>(PatchHeader::zstd_records));
+        patch.append(2, '\0');
+        put_u64(patch, header.source_size);
+        put_u64(patch, header.target_size);
+        put_u64(patch, header.source_hash);
+        put_u64(patch, header.target_hash);
+        patch += frame;
+        put_u64(patch, xxhash64::hash(patch.data(), patch.size()));
+
+        // Zero bytes decode as End records, so a frame within the bound just unpacks
+        PatchDecoder decoder(patch.data(), patch.size());
+
+        if (records_size > max_records_size(header)) {
+            CHECK_THROWS(PatchFormatError, decoder.unpack(source.data(), source.size()));
+        } else {
+            decoder.unpack(source.data(), source.size());
+            PatchRecord record;
+            CHECK(!decoder.next(record));
+        }
+    }
+#endif
+}
+
+int main() {
+    if (!PatchCompression::available) {
+        std::cout << "built without BIN_DIFF_ZSTD, skipped" << std::endl;
+        return skipped;
+    }
+
+    test_round_trip();
+    test_corruption();
+    test_frame_size();
+
+    return report();
+}
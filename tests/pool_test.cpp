@@ -0,0 +1,118 @@
+#include <cstddef>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "diff.hpp"
+#include "patch_apply.hpp"
+#include "thread_pool.hpp"
+
+static bool same_patches(const std::vector<Patch>& a, const std::vector<Patch>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].GetOperation() != b[i].GetOperation() || a[i].offset() != b[i].offset() || a[i].size() != b[i].size()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Threads outside the pool share one queue and one index, each runs its own diff
+// on the pool and must only ever run the forked halves of its own diff
+static void test_callers() {
+    const int callers = 3;
+    const int rounds = 6;
+
+    thread_pool pool(2);
+    std::vector<std::string> lhs;
+    std::vector<std::string> rhs;
+    std::vector<std::vector<Patch>> expected;
+    std::vector<std::vector<Patch>> patches(callers * rounds);
+
+    std::mt19937 random(5);
+
+    for (int i = 0; i < callers * rounds; i++) {
+        lhs.push_back(random_bytes(random, 2000 + random() % 2000, 4));
+        rhs.push_back(mutate(random, lhs.back(), 8));
+        expected.push_back(Diff().diff(lhs.back(), rhs.back()));
+    }
+
+    std::vector<std::thread> threads;
+
+    for (int c = 0; c < callers; c++) {
+        threads.emplace_back([&, c] {
+            DiffOptions options;
+            options.pool = &pool;
+            options.parallel_cutoff = 256;
+
+            Diff diff(options);
+
+            for (int r = 0; r < rounds; r++) {
+                size_t i = static_cast<size_t>(c * rounds + r);
+                patches[i] = diff.diff(lhs[i], rhs[i]);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < patches.size(); i++) {
+        CHECK(same_patches(expected[i], patches[i]));
+        CHECK(apply_patches(lhs[i].data(), lhs[i].size(), patches[i]) == rhs[i]);
+    }
+}
+
+// Waits up to a few seconds for condition, the pool's workers go to sleep on their own time
+template <class t_condition>
+static bool eventually(t_condition&& condition) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+    while (!condition() && std::chrono::steady_clock::now() < until) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return condition();
+}
+
+// Searches only take the workers idle() counts as helpers, busy ones are not counted
+static void test_idle() {
+    thread_pool pool(2);
+    std::atomic<bool> release(false);
+
+    CHECK(eventually([&] { return pool.idle() == 2; }));
+
+    {
+        task_group group(pool);
+
+        for (int i = 0; i < 2; i++) {
+            group.run([&release] {
+                while (!release) {
+                    std::this_thread::yield();
+                }
+            });
+        }
+
+        CHECK(eventually([&] { return pool.idle() == 0; }));
+        release = true;
+    }
+
+    CHECK(eventually([&] { return pool.idle() == 2; }));
+}
+
+int main() {
+    test_callers();
+    test_idle();
+
+    return report();
+}
@@ -0,0 +1,69 @@
+#include <cstddef>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "diff.hpp"
+#include "patch_apply.hpp"
+#include "thread_pool.hpp"
+
+// Built with BIN_DIFF_SWEEP_HELPERS set, so the searches share their rounds with
+// helpers however few cores run the test
+static_assert(BIN_DIFF_SWEEP_HELPERS > 0, "the test needs forced sweep helpers");
+
+static bool same_patches(const std::vector<Patch>& a, const std::vector<Patch>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].GetOperation() != b[i].GetOperation() || a[i].offset() != b[i].offset() || a[i].size() != b[i].size()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Shared searches find the snakes the sequential search finds, so the patches are
+// the same, with a bound on the search cost too
+static void test_equivalence() {
+    std::mt19937 random(28);
+    thread_pool pool(BIN_DIFF_SWEEP_HELPERS);
+
+    for (int round = 0; round < 8; round++) {
+        int alphabet = 2 + static_cast<int>(random() % 6);
+        std::string lhs = random_bytes(random, 2000 + random() % 6000, alphabet);
+        std::string rhs = random_bytes(random, 2000 + random() % 6000, alphabet);
+
+        // Similar inputs as well as unrelated ones
+        if (round % 3 == 0) {
+            rhs = lhs;
+
+            for (int i = 0; i < 1000; i++) {
+                rhs[random() % rhs.size()] = static_cast<char>('a' + random() % static_cast<unsigned>(alphabet));
+            }
+        }
+
+        DiffOptions sequential;
+        sequential.max_cost = round % 4 == 1 ? 1500 : 0;
+
+        DiffOptions shared = sequential;
+        shared.pool = &pool;
+        shared.parallel_sweep = 64;
+        shared.parallel_cutoff = round % 2 == 0 ? 1 << 30 : 1 << 12;
+
+        auto expected = Diff(sequential).diff(lhs, rhs);
+        auto patches = Diff(shared).diff(lhs, rhs);
+        CHECK(same_patches(expected, patches));
+        CHECK(apply_patches(lhs.data(), lhs.size(), patches) == rhs);
+    }
+}
+
+int main() {
+    test_equivalence();
+
+    return report();
+}
@@ -0,0 +1,78 @@
+#include <cstddef>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "tree_diff.hpp"
+
+static void write_file(const std::filesystem::path& path, const std::string& bytes) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+static bool has(const std::vector<TreeEntry>& entries, TreeChange change, const std::string& lhs, const std::string& rhs) {
+    for (const auto& e : entries) {
+        if (e.change == change && e.lhs == lhs && e.rhs == rhs) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Files of equal size are read before they count as the same, whichever side of a
+// path or a rename they are on
+static void test_compare() {
+    std::mt19937 random(17);
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("bin-diff-test-" + std::to_string(std::random_device()()));
+    std::filesystem::path lhs = directory / "lhs";
+    std::filesystem::path rhs = directory / "rhs";
+
+    std::string same = random_bytes(random, 5000);
+    std::string moved = random_bytes(random, 3000);
+    std::string changed = random_bytes(random, 4000);
+    std::string flipped = changed;
+    flipped[2000] = static_cast<char>(flipped[2000] ^ 1);
+
+    write_file(lhs / "same", same);
+    write_file(rhs / "same", same);
+    write_file(lhs / "changed", changed);
+    write_file(rhs / "changed", flipped);
+    write_file(lhs / "grown", same);
+    write_file(rhs / "grown", same + "x");
+    write_file(lhs / "old/moved", moved);
+    write_file(rhs / "new/moved", moved);
+    write_file(lhs / "gone", random_bytes(random, 1000));
+    write_file(rhs / "fresh", random_bytes(random, 1000));
+    write_file(lhs / "empty", "");
+    write_file(rhs / "empty", "");
+
+    for (unsigned threads : { 1u, 4u }) {
+        DiffOptions options;
+        options.threads = threads;
+
+        auto entries = TreeDiff(options).compare(lhs.string(), rhs.string());
+        CHECK(entries.size() == 7);
+        CHECK(has(entries, TreeChange::Unchanged, "same", "same"));
+        CHECK(has(entries, TreeChange::Unchanged, "empty", "empty"));
+        CHECK(has(entries, TreeChange::Modified, "changed", "changed"));
+        CHECK(has(entries, TreeChange::Modified, "grown", "grown"));
+        CHECK(has(entries, TreeChange::Renamed, "old/moved", "new/moved"));
+        CHECK(has(entries, TreeChange::Removed, "gone", ""));
+        CHECK(has(entries, TreeChange::Added, "", "fresh"));
+    }
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+int main() {
+    test_compare();
+
+    return report();
+}